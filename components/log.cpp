@@ -10,18 +10,702 @@
 #include <functional>
 #include <ctime>
 #include <stdarg.h>
-#include <iomanip>
+#include <string.h>
+#include <deque>
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <execinfo.h>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//====================== Implementation of LogStreamBuf ======================
+
+LogStreamBuf::LogStreamBuf() {
+    setp(m_inline, m_inline + kInlineSize);
+}
+
+void LogStreamBuf::reset() {
+    setp(m_inline, m_inline + kInlineSize);
+}
+
+void LogStreamBuf::reserve(size_t len) {
+    size_t used = size();
+    if (len <= (size_t)(epptr() - pptr())) {
+        return;
+    }
+    size_t capacity = std::max(used + len, (size_t)(epptr() - pbase()) * 2);
+    if (pbase() == m_inline) {
+        if (m_heap.size() < capacity) {
+            m_heap.resize(capacity);
+        }
+        memcpy(&m_heap[0], m_inline, used);
+    } else {
+        m_heap.resize(capacity);
+    }
+    setp(&m_heap[0], &m_heap[0] + m_heap.size());
+    //pbump的参数是int, 消息不会超过这个长度
+    pbump((int)used);
+}
+
+void LogStreamBuf::vprintf(const char* fmt, va_list va) {
+    va_list copy;
+    va_copy(copy, va);
+    size_t avail = epptr() - pptr();
+    int len = vsnprintf(pptr(), avail, fmt, copy);
+    va_end(copy);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len >= avail) {
+        //vsnprintf需要额外一个字节写入'\0'
+        reserve(len + 1);
+        vsnprintf(pptr(), len + 1, fmt, va);
+    }
+    pbump(len);
+}
+
+LogStreamBuf::int_type LogStreamBuf::overflow(int_type ch) {
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+        return traits_type::not_eof(ch);
+    }
+    char c = traits_type::to_char_type(ch);
+    append(&c, 1);
+    return ch;
+}
+
+std::streamsize LogStreamBuf::xsputn(const char* str, std::streamsize len) {
+    append(str, len);
+    return len;
+}
+
+//====================== Implementation of LogSite ======================
+static Mutex& GetSiteMutex() {
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+static std::vector<LogSite*>& GetSiteList() {
+    static std::vector<LogSite*> s_sites;
+    return s_sites;
+}
+
+namespace {
+struct DynamicRule {
+    enum Kind { FILE, FUNC, LOGGER };
+    Kind kind;
+    std::string pattern;
+    int32_t line = 0;   //0表示不限行号
+    bool enable = true;
+};
+
+std::vector<DynamicRule>& GetDynamicRules() {
+    static std::vector<DynamicRule> s_rules;
+    return s_rules;
+}
+
+bool ParseDynamicRule(const std::string& str, DynamicRule& rule) {
+    size_t pos = 0;
+    if (!str.empty() && (str[0] == '+' || str[0] == '-')) {
+        rule.enable = str[0] == '+';
+        pos = 1;
+    }
+    size_t colon = str.find(':', pos);
+    if (colon == std::string::npos) {
+        return false;
+    }
+    std::string kind = str.substr(pos, colon - pos);
+    rule.pattern = str.substr(colon + 1);
+    if (kind == "file") {
+        rule.kind = DynamicRule::FILE;
+        size_t line_pos = rule.pattern.rfind(':');
+        if (line_pos != std::string::npos && line_pos + 1 < rule.pattern.size()
+                && rule.pattern.find_first_not_of("0123456789", line_pos + 1) == std::string::npos) {
+            rule.line = atoi(rule.pattern.c_str() + line_pos + 1);
+            rule.pattern.resize(line_pos);
+        }
+    } else if (kind == "func") {
+        rule.kind = DynamicRule::FUNC;
+    } else if (kind == "logger") {
+        rule.kind = DynamicRule::LOGGER;
+    } else {
+        return false;
+    }
+    return !rule.pattern.empty();
+}
+
+//调用时需持有GetSiteMutex()
+uint8_t ApplyDynamicRules(const LogSite& site) {
+    uint8_t state = LogSite::ENABLED;
+    const char* base = strrchr(site.file, '/');
+    base = base ? base + 1 : site.file;
+    for (auto& rule : GetDynamicRules()) {
+        bool match = false;
+        if (rule.kind == DynamicRule::FILE) {
+            match = (rule.line == 0 || rule.line == site.line)
+                    && (fnmatch(rule.pattern.c_str(), site.file, 0) == 0
+                        || fnmatch(rule.pattern.c_str(), base, 0) == 0);
+        } else if (rule.kind == DynamicRule::FUNC) {
+            match = site.func && fnmatch(rule.pattern.c_str(), site.func, 0) == 0;
+        }
+        if (match) {
+            state = rule.enable ? LogSite::FORCED : LogSite::DISABLED;
+        }
+    }
+    return state;
+}
+}
+
+bool LogSite::checkSlow(LogLevel::Level logger_level, LogLevel::Level site_level, const char* site_func) {
+    uint8_t s = state.load(std::memory_order_acquire);
+    if (s == UNREGISTERED) {
+        Mutex::Lock lock(GetSiteMutex());
+        s = state.load(std::memory_order_relaxed);
+        if (s == UNREGISTERED) {
+            auto& sites = GetSiteList();
+            sites.push_back(this);
+            func = site_func;
+            level = site_level;
+            id.store(sites.size(), std::memory_order_relaxed);
+            s = ApplyDynamicRules(*this);
+            state.store(s, std::memory_order_release);
+        }
+    }
+    return s == FORCED || (s == ENABLED && logger_level <= site_level);
+}
+
+void LogSite::setEnabled(bool v) {
+    Mutex::Lock lock(GetSiteMutex());
+    if (state.load(std::memory_order_relaxed) != UNREGISTERED) {
+        state.store(v ? ENABLED : DISABLED, std::memory_order_relaxed);
+    }
+}
+
+void LogSite::SetDynamicRules(const std::vector<std::string>& rules) {
+    std::vector<DynamicRule> parsed;
+    for (auto& str : rules) {
+        DynamicRule rule;
+        if (ParseDynamicRule(str, rule)) {
+            parsed.push_back(rule);
+        } else {
+            std::cout << "invalid log.dynamic_debug rule: " << str << std::endl;
+        }
+    }
+    {
+        Mutex::Lock lock(GetSiteMutex());
+        GetDynamicRules().swap(parsed);
+        for (auto site : GetSiteList()) {
+            site->state.store(ApplyDynamicRules(*site), std::memory_order_relaxed);
+        }
+    }
+    for (auto& logger : LoggerMgr::GetInstance()->getLoggers()) {
+        logger->setDebugForced(MatchLogger(logger->getName()));
+    }
+}
+
+bool LogSite::MatchLogger(const std::string& name) {
+    Mutex::Lock lock(GetSiteMutex());
+    bool forced = false;
+    for (auto& rule : GetDynamicRules()) {
+        if (rule.kind == DynamicRule::LOGGER && fnmatch(rule.pattern.c_str(), name.c_str(), 0) == 0) {
+            forced = rule.enable;
+        }
+    }
+    return forced;
+}
+
+std::vector<LogSite*> LogSite::GetSites() {
+    Mutex::Lock lock(GetSiteMutex());
+    return GetSiteList();
+}
+
+//====================== Implementation of LogLimiter ======================
+static std::atomic<uint32_t> s_log_summary_interval = {10000};
+
+void LogLimiter::SetSummaryInterval(uint32_t ms) {
+    s_log_summary_interval = ms;
+}
+
+bool LogLimiter::suppress(const LogSite* site, const std::shared_ptr<Logger>& logger, LogLevel::Level level, uint64_t now) {
+    m_suppressed.fetch_add(1, std::memory_order_relaxed);
+    uint32_t interval = s_log_summary_interval.load(std::memory_order_relaxed);
+    if (interval == 0) {
+        return false;
+    }
+    if (now == 0) {
+        now = GetCurrentMS();
+    }
+    uint64_t last = m_lastSummary.load(std::memory_order_relaxed);
+    if (last == 0) {
+        //第一次被抑制时开始计时
+        m_lastSummary.compare_exchange_strong(last, now, std::memory_order_relaxed);
+        return false;
+    }
+    if (now - last < interval || !m_lastSummary.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+        return false;
+    }
+    uint64_t count = m_suppressed.exchange(0, std::memory_order_relaxed);
+    if (count) {
+        LogEventWrap(LogEvent::Acquire(site, logger, level, GetElapseMS(), GetThreadId(), GetFiberId(), GetCurrentUS(), Thread::GetName()))
+                .getStringstream() << count << " messages suppressed in the last " << (now - last) << "ms";
+    }
+    return false;
+}
+
+uint32_t LogLimiter::Random() {
+    static thread_local uint32_t s_state = 0;
+    if (s_state == 0) {
+        s_state = (uint32_t)GetCurrentUS() ^ ((uint32_t)GetThreadId() * 2654435761u);
+        if (s_state == 0) {
+            s_state = 1;
+        }
+    }
+    s_state ^= s_state << 13;
+    s_state ^= s_state >> 17;
+    s_state ^= s_state << 5;
+    return s_state;
+}
+
+//====================== Implementation of logarg ======================
+namespace logarg {
+
+namespace {
+class Reader {
+public:
+    Reader(const char* data, size_t len) : m_pos(data), m_end(data + len) {
+    }
+
+    char next() {
+        if (m_pos >= m_end) {
+            return 0;
+        }
+        char tag = *m_pos++;
+        if (tag == STRING) {
+            uint32_t len = 0;
+            read(&len, sizeof(len));
+            m_str = m_pos;
+            m_strLen = std::min((size_t)len, (size_t)(m_end - m_pos));
+            m_pos += m_strLen;
+        } else {
+            m_value = 0;
+            read(&m_value, sizeof(m_value));
+        }
+        m_tag = tag;
+        return tag;
+    }
+
+    int64_t getInt() const {
+        if (m_tag == DOUBLE) {
+            double d;
+            memcpy(&d, &m_value, sizeof(d));
+            return (int64_t)d;
+        }
+        return m_tag == STRING ? 0 : (int64_t)m_value;
+    }
+
+    double getDouble() const {
+        if (m_tag == DOUBLE) {
+            double d;
+            memcpy(&d, &m_value, sizeof(d));
+            return d;
+        }
+        if (m_tag == INT) {
+            return (double)(int64_t)m_value;
+        }
+        return m_tag == STRING ? 0 : (double)m_value;
+    }
+
+    const char* getString(size_t& len) const {
+        if (m_tag != STRING) {
+            len = 6;
+            return "(null)";
+        }
+        len = m_strLen;
+        return m_str;
+    }
+private:
+    void read(void* out, size_t len) {
+        if ((size_t)(m_end - m_pos) < len) {
+            m_pos = m_end;
+            return;
+        }
+        memcpy(out, m_pos, len);
+        m_pos += len;
+    }
+private:
+    const char* m_pos;
+    const char* m_end;
+    char m_tag = 0;
+    uint64_t m_value = 0;
+    const char* m_str = nullptr;
+    size_t m_strLen = 0;
+};
+
+void AppendFormat(LogStreamBuf& buf, const char* spec, ...) {
+    va_list va;
+    va_start(va, spec);
+    buf.vprintf(spec, va);
+    va_end(va);
+}
+
+//base只能是8/10/16; 分开处理让除数成为常量, 编译器可以用乘法和移位代替除法
+void AppendUnsigned(LogStreamBuf& buf, uint64_t val, unsigned base, bool upper) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[24];
+    char* end = tmp + sizeof(tmp);
+    char* ptr = end;
+    if (base == 10) {
+        do {
+            *--ptr = '0' + val % 10;
+            val /= 10;
+        } while (val);
+    } else {
+        unsigned shift = base == 16 ? 4 : 3;
+        do {
+            *--ptr = digits[val & (base - 1)];
+            val >>= shift;
+        } while (val);
+    }
+    buf.append(ptr, end - ptr);
+}
+
+void AppendSigned(LogStreamBuf& buf, int64_t val) {
+    if (val < 0) {
+        buf.append("-", 1);
+        AppendUnsigned(buf, 0 - (uint64_t)val, 10, false);
+    } else {
+        AppendUnsigned(buf, val, 10, false);
+    }
+}
+
+//不带标志/宽度/精度的转换, 不支持的返回false且不读取参数
+bool AppendSimple(LogStreamBuf& buf, Reader& reader, char conv) {
+    switch (conv) {
+        case 'd':
+        case 'i':
+            reader.next();
+            AppendSigned(buf, reader.getInt());
+            return true;
+        case 'u':
+            reader.next();
+            AppendUnsigned(buf, reader.getInt(), 10, false);
+            return true;
+        case 'x':
+        case 'X':
+            reader.next();
+            AppendUnsigned(buf, reader.getInt(), 16, conv == 'X');
+            return true;
+        case 'o':
+            reader.next();
+            AppendUnsigned(buf, reader.getInt(), 8, false);
+            return true;
+        case 's': {
+            reader.next();
+            size_t str_len = 0;
+            const char* str = reader.getString(str_len);
+            buf.append(str, str_len);
+            return true;
+        }
+        case 'c': {
+            reader.next();
+            char c = (char)reader.getInt();
+            buf.append(&c, 1);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+}
+
+void Render(LogStreamBuf& buf, const char* fmt, const char* data, size_t len) {
+    Reader reader(data, len);
+    const char* p = fmt;
+    while (*p) {
+        const char* pct = strchr(p, '%');
+        if (!pct) {
+            pct = p + strlen(p);
+        }
+        buf.append(p, pct - p);
+        if (!*pct) {
+            break;
+        }
+        if (pct[1] == '%') {
+            buf.append("%", 1);
+            p = pct + 2;
+            continue;
+        }
+
+        //没有标志/宽度/精度的常见转换直接输出, 不经过snprintf
+        const char* r = pct + 1;
+        while (*r && strchr("hljztLq", *r)) {
+            ++r;
+        }
+        if (*r && AppendSimple(buf, reader, *r)) {
+            p = r + 1;
+            continue;
+        }
+
+        //重新生成转换说明: 去掉长度修饰符, 整数统一按long long输出, *用实际的参数值代替
+        char spec[64] = "%";
+        size_t n = 1;
+        const char* q = pct + 1;
+        while (*q && strchr("-+ #0'", *q) && n < 16) {
+            spec[n++] = *q++;
+        }
+        if (*q == '*') {
+            reader.next();
+            n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)reader.getInt());
+            ++q;
+        } else {
+            while (isdigit(*q) && n < 32) {
+                spec[n++] = *q++;
+            }
+        }
+
+        int precision = -1;
+        if (*q == '.') {
+            ++q;
+            precision = 0;
+            if (*q == '*') {
+                reader.next();
+                precision = (int)reader.getInt();
+                ++q;
+            } else {
+                while (isdigit(*q)) {
+                    precision = precision * 10 + (*q++ - '0');
+                }
+            }
+        }
+        while (*q && strchr("hljztLq", *q)) {
+            ++q;
+        }
+        char conv = *q;
+        if (!conv) {
+            break;
+        }
+        p = q + 1;
+        if (precision >= 0 && conv != 's') {
+            n += snprintf(spec + n, sizeof(spec) - n, ".%d", precision);
+        }
+
+        switch (conv) {
+            case 'd':
+            case 'i':
+                reader.next();
+                snprintf(spec + n, sizeof(spec) - n, "ll%c", conv);
+                AppendFormat(buf, spec, (long long)reader.getInt());
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                reader.next();
+                snprintf(spec + n, sizeof(spec) - n, "ll%c", conv);
+                AppendFormat(buf, spec, (unsigned long long)reader.getInt());
+                break;
+            case 'c':
+                reader.next();
+                snprintf(spec + n, sizeof(spec) - n, "c");
+                AppendFormat(buf, spec, (int)reader.getInt());
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                reader.next();
+                snprintf(spec + n, sizeof(spec) - n, "%c", conv);
+                AppendFormat(buf, spec, reader.getDouble());
+                break;
+            case 's': {
+                reader.next();
+                size_t str_len = 0;
+                const char* str = reader.getString(str_len);
+                if (precision >= 0 && (size_t)precision < str_len) {
+                    str_len = precision;
+                }
+                snprintf(spec + n, sizeof(spec) - n, ".*s");
+                AppendFormat(buf, spec, (int)str_len, str);
+                break;
+            }
+            case 'p':
+                reader.next();
+                AppendFormat(buf, "%p", (void*)(uintptr_t)reader.getInt());
+                break;
+            case 'n':
+                reader.next();
+                break;
+            default:
+                buf.append(pct, p - pct);
+                break;
+        }
+    }
+}
+
+}
 
 //====================== Implementation of LogEvent::LogEvent ======================
 
 LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
         , const char* file, int32_t line
         , uint32_t elapse, uint32_t threadid
-        , uint32_t fiberid, uint32_t time
+        , uint32_t fiberid, uint64_t time_us
         , const std::string& thread_name)
     : m_file(file), m_line(line), m_threadid(threadid), m_thread_name(thread_name)
-    , m_elapse(elapse) , m_fiberid(fiberid), m_time(time)
-    , m_logger(logger) , m_level(level){
+    , m_elapse(elapse) , m_fiberid(fiberid), m_time(time_us / 1000000), m_usec(time_us % 1000000)
+    , m_stream(&m_buf), m_logger(logger) , m_level(level){
+    m_stream.pword(StreamIndex()) = this;
+}
+
+int LogEvent::StreamIndex() {
+    static const int s_index = std::ios_base::xalloc();
+    return s_index;
+}
+
+namespace {
+void AppendFieldValue(std::string& buf, const LogField& field) {
+    char tmp[32];
+    int len = 0;
+    switch (field.type) {
+        case LogField::STRING:
+            LogFormatter::AppendJsonString(buf, field.str, field.len);
+            return;
+        case LogField::INT:
+            len = snprintf(tmp, sizeof(tmp), "%lld", (long long)field.i);
+            break;
+        case LogField::UINT:
+            len = snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)field.u);
+            break;
+        case LogField::DOUBLE:
+            //JSON没有nan/inf
+            len = std::isfinite(field.d) ? snprintf(tmp, sizeof(tmp), "%.17g", field.d) : snprintf(tmp, sizeof(tmp), "null");
+            break;
+        case LogField::BOOL:
+            len = snprintf(tmp, sizeof(tmp), "%s", field.i ? "true" : "false");
+            break;
+    }
+    buf.append(tmp, len);
+}
+}
+
+void LogEvent::addField(const LogField& field) {
+    m_fields.push_back(',');
+    LogFormatter::AppendJsonString(m_fields, field.key, strlen(field.key));
+    m_fields.push_back(':');
+    AppendFieldValue(m_fields, field);
+}
+
+std::ostream& operator<<(std::ostream& os, const LogField& field) {
+    LogEvent* event = (LogEvent*)os.pword(LogEvent::StreamIndex());
+    if (event) {
+        event->addField(field);
+        return os;
+    }
+    os << field.key << '=';
+    switch (field.type) {
+        case LogField::STRING:
+            os.write(field.str, field.len);
+            break;
+        case LogField::INT:
+            os << field.i;
+            break;
+        case LogField::UINT:
+            os << field.u;
+            break;
+        case LogField::DOUBLE:
+            os << field.d;
+            break;
+        case LogField::BOOL:
+            os << (field.i ? "true" : "false");
+            break;
+    }
+    return os;
+}
+
+LogEvent::pointer LogEvent::Acquire(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+        , const char* file, int32_t line
+        , uint32_t elapse, uint32_t threadid
+        , uint32_t fiberid, uint64_t time_us
+        , const std::string& thread_name) {
+    //同步输出时事件在LogEventWrap析构后即空闲, 嵌套打印或LogPipeline排队时才会占用多个
+    static const size_t kPoolSize = 8;
+    static thread_local LogEvent::pointer t_pool[kPoolSize];
+    static thread_local size_t t_next = 0;
+
+    for (size_t i = 0; i < kPoolSize; i++) {
+        LogEvent::pointer& event = t_pool[t_next];
+        t_next = (t_next + 1) % kPoolSize;
+        if (!event) {
+            event = std::make_shared<LogEvent>(logger, level, file, line, elapse, threadid, fiberid, time_us, thread_name);
+            return event;
+        }
+        if (event.use_count() == 1) {
+            //与其他线程释放引用时的写操作同步
+            std::atomic_thread_fence(std::memory_order_acquire);
+            event->reset(logger, level, file, line, elapse, threadid, fiberid, time_us, thread_name);
+            return event;
+        }
+    }
+    return std::make_shared<LogEvent>(logger, level, file, line, elapse, threadid, fiberid, time_us, thread_name);
+}
+
+LogEvent::pointer LogEvent::Acquire(const LogSite* site, const std::shared_ptr<Logger>& logger, LogLevel::Level level
+        , uint32_t elapse, uint32_t threadid
+        , uint32_t fiberid, uint64_t time_us
+        , const std::string& thread_name) {
+    LogEvent::pointer event = Acquire(logger, level, site->file, site->line, elapse, threadid, fiberid, time_us, thread_name);
+    event->m_site = site;
+    return event;
+}
+
+void LogEvent::reset(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+        , const char* file, int32_t line
+        , uint32_t elapse, uint32_t threadid
+        , uint32_t fiberid, uint64_t time_us
+        , const std::string& thread_name) {
+    m_file = file;
+    m_line = line;
+    m_threadid = threadid;
+    m_thread_name.assign(thread_name);
+    m_elapse = elapse;
+    m_fiberid = fiberid;
+    m_time = time_us / 1000000;
+    m_usec = time_us % 1000000;
+    //同一个logger时不再复制shared_ptr, 省去原子操作
+    if (m_logger != logger) {
+        m_logger = logger;
+    }
+    m_level = level;
+
+    m_buf.reset();
+    m_site = nullptr;
+    m_fmt = nullptr;
+    m_args.clear();
+    m_argsPending = false;
+    m_fields.clear();
+    m_stream.clear();
+    m_stream.flags(std::ios_base::dec | std::ios_base::skipws);
+    m_stream.precision(6);
+    m_stream.width(0);
+    m_stream.fill(' ');
 }
 
 void LogEvent::format(const char* fmt, ...){
@@ -32,517 +716,3062 @@ void LogEvent::format(const char* fmt, ...){
 }
 
 void LogEvent::format(const char* fmt, va_list va){
-    char* buf = nullptr;
-    int len = vasprintf(&buf, fmt, va);
-    if (len != -1){
-        m_sstream << std::string(buf, len);
-        free(buf);
+    m_buf.vprintf(fmt, va);
+}
+
+void LogEvent::setArgs(const char* fmt, const char* data, size_t len) {
+    m_site = nullptr;
+    m_fmt = fmt;
+    m_args.assign(data, len);
+    m_argsPending = true;
+}
+
+LogEvent::~LogEvent() {
+
+}
+
+LogEventWrap::LogEventWrap(LogEvent::pointer event) : m_event(std::move(event)){
+
+}
+
+LogEventWrap::~LogEventWrap(){
+    if (LogCrashHandler::IsInstalled()) {
+        LogCrashHandler::Record(*m_event);
+    }
+    if (LogPipeline::IsEnabled() && LogPipelineMgr::GetInstance()->push(m_event)) {
+        return;
+    }
+    //协程中不同步输出, 交给收集线程; ERROR/FATAL之后进程可能马上退出, 仍然同步输出
+    if (LogPipeline::IsFiberOffload() && m_event->getLevel() < LogLevel::ERROR && GetFiberId() != 0) {
+        LogPipelineMgr::GetInstance()->pushFromFiber(m_event);
+        return;
+    }
+    m_event->getLogger()->log(m_event->getLevel(), m_event);
+}
+
+//====================== Implementation of LogFormatter::Append ======================
+
+//各个Appender格式化时复用的线程局部缓冲区
+static std::string& GetFormatBuffer() {
+    static thread_local std::string t_buffer;
+    t_buffer.clear();
+    return t_buffer;
+}
+
+void LogFormatter::Append(std::string& buf, size_t& width, const char* str, size_t len) {
+    if (width > len) {
+        buf.append(width - len, ' ');
+    }
+    width = 0;
+    buf.append(str, len);
+}
+
+void LogFormatter::AppendNumber(std::string& buf, size_t& width, int64_t val) {
+    char tmp[24];
+    char* end = tmp + sizeof(tmp);
+    char* p = end;
+    uint64_t n = val < 0 ? 0 - (uint64_t)val : (uint64_t)val;
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    if (val < 0) {
+        *--p = '-';
+    }
+    Append(buf, width, p, end - p);
+}
+
+LogFormatter::DateTimeFormat::DateTimeFormat(const std::string& fmt)
+    : format(fmt), digits(0) {
+    static std::atomic<uint32_t> s_id = {0};
+    id = ++s_id;
+    if (format.empty()) {
+        format = "%Y-%m-%d %H:%M:%S";
+    }
+    if (format.size() >= 3) {
+        std::string suffix = format.substr(format.size() - 3);
+        if (suffix == "%ms" || suffix == "%us") {
+            digits = suffix == "%ms" ? 3 : 6;
+            format.resize(format.size() - 3);
+        }
+    }
+}
+
+namespace {
+struct DateTimeCache {
+    uint32_t id = 0;
+    uint64_t time = 0;
+    size_t len = 0;
+    char buf[64];
+};
+}
+
+void LogFormatter::AppendDateTime(std::string& buf, size_t& width, const DateTimeFormat& fmt, uint64_t time, uint32_t usec) {
+    static thread_local DateTimeCache t_cache[4];
+    DateTimeCache& cache = t_cache[fmt.id % 4];
+    if (cache.id != fmt.id || cache.time != time) {
+        struct tm tm;
+        time_t t = time;
+        localtime_r(&t, &tm);
+        cache.len = strftime(cache.buf, sizeof(cache.buf), fmt.format.c_str(), &tm);
+        cache.id = fmt.id;
+        cache.time = time;
+    }
+    if (!fmt.digits) {
+        Append(buf, width, cache.buf, cache.len);
+        return;
+    }
+
+    char tmp[sizeof(cache.buf) + 6];
+    memcpy(tmp, cache.buf, cache.len);
+    uint32_t frac = fmt.digits == 3 ? usec / 1000 : usec;
+    for (int i = fmt.digits - 1; i >= 0; i--) {
+        tmp[cache.len + i] = '0' + frac % 10;
+        frac /= 10;
+    }
+    Append(buf, width, tmp, cache.len + fmt.digits);
+}
+
+
+const char* const LogFormatter::kJsonDateFormat = "%Y-%m-%dT%H:%M:%S.%us";
+
+namespace {
+//0表示不需要转义, 否则为\后面的字符; 'u'表示输出\u00XX
+struct JsonEscapeTable {
+    char table[256];
+
+    JsonEscapeTable() {
+        memset(table, 0, sizeof(table));
+        for (int i = 0; i < 0x20; ++i) {
+            table[i] = 'u';
+        }
+        table[(uint8_t)'"'] = '"';
+        table[(uint8_t)'\\'] = '\\';
+        table['\b'] = 'b';
+        table['\f'] = 'f';
+        table['\n'] = 'n';
+        table['\r'] = 'r';
+        table['\t'] = 't';
+    }
+};
+
+const JsonEscapeTable s_json_escape;
+}
+
+void LogFormatter::AppendJsonString(std::string& buf, const char* str, size_t len) {
+    const char* p = str;
+    const char* end = str + len;
+    buf.push_back('"');
+    while (p < end) {
+        //找到下一个需要转义的字符, 之前的部分整段复制
+        const char* run = p;
+#ifdef __SSE2__
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1f);
+        while (end - p >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            //无符号比较 v <= 0x1f 等价于 max(v, 0x1f) == 0x1f
+            __m128i mask = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash))
+                    , _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+            int bits = _mm_movemask_epi8(mask);
+            if (bits) {
+                p += __builtin_ctz(bits);
+                break;
+            }
+            p += 16;
+        }
+#endif
+        while (p < end && !s_json_escape.table[(uint8_t)*p]) {
+            ++p;
+        }
+        buf.append(run, p - run);
+        if (p == end) {
+            break;
+        }
+        char esc = s_json_escape.table[(uint8_t)*p];
+        if (esc == 'u') {
+            static const char* const kHex = "0123456789abcdef";
+            char tmp[6] = {'\\', 'u', '0', '0', kHex[(uint8_t)*p >> 4], kHex[*p & 0xf]};
+            buf.append(tmp, 6);
+        } else {
+            char tmp[2] = {'\\', esc};
+            buf.append(tmp, 2);
+        }
+        ++p;
+    }
+    buf.push_back('"');
+}
+
+void LogFormatter::AppendJson(std::string& buf, size_t& width, const DateTimeFormat& date, LogLevel::Level level, const LogEvent& event) {
+    size_t w = 0;
+    buf.append("{\"time\":\"");
+    AppendDateTime(buf, w, date, event.getTime(), event.getUsec());
+    buf.append("\",\"level\":\"");
+    buf.append(LogLevel::ToString(level));
+    buf.append("\",\"logger\":");
+    const std::string& name = event.getLogger()->getName();
+    AppendJsonString(buf, name.c_str(), name.size());
+    buf.append(",\"thread_id\":");
+    AppendNumber(buf, w, event.getThreadId());
+    buf.append(",\"thread_name\":");
+    AppendJsonString(buf, event.getThreadName().c_str(), event.getThreadName().size());
+    buf.append(",\"fiber_id\":");
+    AppendNumber(buf, w, event.getFiberId());
+    buf.append(",\"elapse\":");
+    AppendNumber(buf, w, event.getElapse());
+    buf.append(",\"file\":");
+    AppendJsonString(buf, event.getFile(), strlen(event.getFile()));
+    buf.append(",\"line\":");
+    AppendNumber(buf, w, event.getLine());
+    buf.append(",\"message\":");
+    AppendJsonString(buf, event.getContentData(), event.getContentSize());
+    buf.append(event.getFields());
+    buf.push_back('}');
+    width = 0;
+}
+
+const char* LogLevel::ToString(LogLevel::Level level) {
+    switch (level){
+#define OUTPUT(name) \
+        case LogLevel::name: \
+            return #name; \
+            break;
+
+        OUTPUT(DEBUG);
+        OUTPUT(INFO);
+        OUTPUT(WARN);
+        OUTPUT(ERROR);
+        OUTPUT(FATAL);
+#undef OUTPUT
+        default:
+            return "UNKNOWN";
+    }
+    return "UNKNOWN";
+}
+
+LogLevel::Level LogLevel::FromString(const std::string& str){
+#define OUTPUT(level, val) \
+    if (#val == str) \
+        return LogLevel::level
+
+    OUTPUT(DEBUG, debug);
+    OUTPUT(INFO, info);
+    OUTPUT(WARN, warn);
+    OUTPUT(ERROR, error);
+    OUTPUT(FATAL, fatal);
+
+    OUTPUT(DEBUG, DEBUG);
+    OUTPUT(INFO, INFO);
+    OUTPUT(WARN, WARN);
+    OUTPUT(ERROR, ERROR);
+    OUTPUT(FATAL, FATAL);
+
+#undef OUTPUT
+    return LogLevel::UNKONWN;
+}
+
+//====================== Implementation of Logger ======================
+
+Logger::Logger(const std::string& name) : m_name(name), m_level(LogLevel::DEBUG), m_effectiveLevel(LogLevel::DEBUG)
+    , m_appenders(std::make_shared<const AppenderList>()) {
+    //%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n
+    using namespace logfmt;
+    m_formatter = LogFormatter::Create<DateTime<>, Tab, ThreadId, Tab, ThreadName, Tab, FiberId, Tab
+            , Char<'['>, Level, Char<']'>, Tab, Char<'['>, Name, Char<']'>, Tab
+            , Filename, Char<':'>, Line, Tab, Message, NewLine>();
+    std::shared_ptr<Output> output = std::make_shared<Output>();
+    output->appenders = m_appenders;
+    output->owner = this;
+    m_output = std::move(output);
+}
+
+Logger::~Logger() {
+    if (m_parent) {
+        MutexType::Lock lock(TreeMutex());
+        auto& siblings = m_parent->m_children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), this), siblings.end());
+    }
+}
+
+Logger::MutexType& Logger::TreeMutex() {
+    //不析构, 退出过程中仍可使用
+    static MutexType* s_mutex = new MutexType;
+    return *s_mutex;
+}
+
+void Logger::setLevel(LogLevel::Level level) {
+    m_level = level;
+    resolve();
+}
+
+void Logger::setDebugForced(bool v) {
+    m_debugForced = v;
+    resolve();
+}
+
+void Logger::resolve() {
+    MutexType::Lock lock(TreeMutex());
+    resolveLocked();
+}
+
+void Logger::resolveLocked() {
+    LogLevel::Level level = m_level;
+    if (level == LogLevel::UNKONWN) {
+        level = m_parent ? m_parent->m_resolvedLevel : LogLevel::DEBUG;
+    }
+    m_resolvedLevel = level;
+    m_effectiveLevel.store(isDebugForced() ? std::min(level, LogLevel::DEBUG) : level, std::memory_order_relaxed);
+
+    std::shared_ptr<const AppenderList> appenders = getAppenders();
+    if (appenders->empty() && m_parent) {
+        std::atomic_store(&m_output, std::atomic_load(&m_parent->m_output));
+    } else {
+        std::shared_ptr<Output> output = std::make_shared<Output>();
+        output->appenders = std::move(appenders);
+        output->owner = this;
+        std::atomic_store(&m_output, std::shared_ptr<const Output>(std::move(output)));
+    }
+
+    for (Logger* child : m_children) {
+        child->resolveLocked();
+    }
+}
+
+void Logger::log(LogLevel::Level level, LogEvent::pointer event){
+    //动态调试选中的调用点不受级别限制; 选中的logger已经合并到m_effectiveLevel中
+    const LogSite* site = event->getSite();
+    if (level >= getEffectiveLevel() || (site && site->isForced())){
+        std::shared_ptr<const Output> output = std::atomic_load(&m_output);
+        const AppenderList& appenders = *output->appenders;
+        if (appenders.empty()) {
+            return;
+        }
+        //需要Logger类继承std::enable_shared_from_this<Logger> 避免两个不同的shared_ptr 指向同一个对象，重复销毁
+        //继承的appender以所属的祖先日志器输出
+        auto owner = output->owner->shared_from_this();
+        if (appenders.size() == 1){
+            appenders.front()->log(owner, level, event);
+        } else {
+            logFanOut(owner, appenders, level, event);
+        }
+    }
+}
+
+namespace {
+//Logger::logFanOut使用的线程局部缓冲区, 每个formatter一块
+struct FanOutBuffers {
+    static const size_t kMaxFormatters = 4;
+    //持有引用, 避免formatter在输出过程中被替换释放后地址被复用
+    LogFormatter::pointer formatters[kMaxFormatters];
+    std::string buffers[kMaxFormatters];
+    size_t size = 0;
+    bool busy = false;
+};
+}
+
+void Logger::logFanOut(const Logger::pointer& self, const AppenderList& appenders, LogLevel::Level level
+        , const LogEvent::pointer& event) {
+    static thread_local FanOutBuffers s_fanout;
+    //appender输出时又写日志(重入)的情况不共享缓冲区
+    if (s_fanout.busy) {
+        for (auto& appender : appenders) {
+            appender->log(self, level, event);
+        }
+        return;
+    }
+    s_fanout.busy = true;
+    s_fanout.size = 0;
+    for (auto& appender : appenders) {
+        if (!appender->usesFormatter() || level < appender->getLevel()) {
+            appender->log(self, level, event);
+            continue;
+        }
+        LogFormatter::pointer formatter = appender->getFormatter();
+        size_t i = 0;
+        while (i < s_fanout.size && s_fanout.formatters[i] != formatter) {
+            ++i;
+        }
+        if (i == s_fanout.size) {
+            if (i == FanOutBuffers::kMaxFormatters) {
+                appender->log(self, level, event);
+                continue;
+            }
+            s_fanout.formatters[i] = formatter;
+            s_fanout.buffers[i].clear();
+            formatter->format(s_fanout.buffers[i], self, level, event);
+            ++s_fanout.size;
+        }
+        appender->logFormatted(self, level, event, s_fanout.buffers[i]);
+    }
+    for (size_t i = 0; i < s_fanout.size; ++i) {
+        s_fanout.formatters[i].reset();
+    }
+    s_fanout.busy = false;
+}
+
+void Logger::debug(LogEvent::pointer event){
+    log(LogLevel::DEBUG, event);
+}
+void Logger::info(LogEvent::pointer event){
+    log(LogLevel::INFO, event);
+}
+void Logger::warn(LogEvent::pointer event){
+    log(LogLevel::WARN, event);
+}
+void Logger::error(LogEvent::pointer event){
+    log(LogLevel::ERROR, event);
+}
+void Logger::fatal(LogEvent::pointer event){
+    log(LogLevel::FATAL, event);
+}
+
+void Logger::addAppender(LogAppender::pointer appender){
+    {
+        MutexType::Lock lock(m_mutex);
+        if(!appender->getFormatter()){
+            appender->setFormatter(m_formatter, false);
+        }
+        std::shared_ptr<AppenderList> appenders = std::make_shared<AppenderList>(*m_appenders);
+        appenders->push_back(appender);
+        std::atomic_store(&m_appenders, std::shared_ptr<const AppenderList>(std::move(appenders)));
+    }
+    resolve();
+}
+void Logger::delAppender(LogAppender::pointer appender){
+    {
+        MutexType::Lock lock(m_mutex);
+        std::shared_ptr<AppenderList> appenders = std::make_shared<AppenderList>(*m_appenders);
+        for(auto iter = appenders->begin(); iter != appenders->end(); iter++){
+            if(*iter == appender){
+                appenders->erase(iter);
+                std::atomic_store(&m_appenders, std::shared_ptr<const AppenderList>(std::move(appenders)));
+                break;
+            }
+        }
+    }
+    resolve();
+}
+
+void Logger::clearAppender() {
+    {
+        MutexType::Lock lock(m_mutex);
+        std::atomic_store(&m_appenders, std::make_shared<const AppenderList>());
+    }
+    resolve();
+}
+
+void Logger::setFormatter(LogFormatter::pointer val){
+    MutexType::Lock lock(m_mutex);
+    m_formatter = val;
+
+    for(auto& appender : *m_appenders){
+        //Mutex::Lock appender_lock(appender->m_mutex);
+        if (!appender->hasFormatter()){
+            appender->setFormatter(val, false);
+        }
+    }
+}
+
+void Logger::setFormatter(const std::string& val){
+    LogFormatter::pointer new_formatter(new LogFormatter(val));
+    if (new_formatter->isError()){
+        std::cout << "Logger setFormatter name = " << m_name
+                  << " value = " << val << " invalid formatter\n";
+        return;
+    }
+    setFormatter(new_formatter);
+}
+
+std::string Logger::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["name"] = m_name;
+    if (m_level != LogLevel::UNKONWN){
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if (m_formatter){
+        node["format"] = m_formatter->getPattern();
+    }
+
+    for(auto& i : *m_appenders){
+        node["appenders"].push_back(YAML::Load(i->toYamlString()));
+    }
+
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+//====================== Implementation of LogAppender ======================
+//写完整个缓冲区, 被信号打断时重试; 只调用write(2), 可以在信号处理函数中使用
+static void WriteFully(int fd, const char* data, size_t len) {
+    while (len > 0 && fd >= 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+//信号处理函数中不能等待锁: 持有锁的可能正是崩溃的线程
+template<class T>
+static bool CrashTryLock(T& mutex) {
+    for (int i = 0; i < 1000; ++i) {
+        if (mutex.tryLock()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LogAppender::formatAndLog(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) {
+    if (level >= m_level) {
+        std::string& buf = GetFormatBuffer();
+        getFormatter()->format(buf, logger, level, event);
+        logFormatted(logger, level, event, buf);
+    }
+}
+
+void LogAppender::waitForSpace(MutexType::Lock& lock) {
+    ++m_spaceWaiters;
+    lock.unlock();
+    m_space.wait();
+    lock.lock();
+}
+
+void LogAppender::notifySpace() {
+    for (; m_spaceWaiters > 0; --m_spaceWaiters) {
+        m_space.notify();
+    }
+}
+
+LogOverload::Policy LogOverload::FromString(const std::string& str) {
+    if (str == "drop_newest") {
+        return DROP_NEWEST;
+    } else if (str == "drop_oldest") {
+        return DROP_OLDEST;
+    } else if (str == "drop_below_level") {
+        return DROP_BELOW_LEVEL;
+    }
+    return BLOCK;
+}
+
+const char* LogOverload::ToString(Policy policy) {
+    switch (policy) {
+        case DROP_NEWEST:
+            return "drop_newest";
+        case DROP_OLDEST:
+            return "drop_oldest";
+        case DROP_BELOW_LEVEL:
+            return "drop_below_level";
+        default:
+            return "block";
+    }
+}
+
+LogAppenderMetrics::LogAppenderMetrics() {
+    for (auto& bucket : m_flushLatency) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LogAppenderMetrics::onFlush(uint64_t us) {
+    size_t bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if (bucket >= kLatencyBuckets) {
+        bucket = kLatencyBuckets - 1;
+    }
+    m_flushLatency[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_flushes.fetch_add(1, std::memory_order_relaxed);
+}
+
+LogAppenderMetrics::Snapshot LogAppenderMetrics::snapshot() const {
+    Snapshot snapshot;
+    snapshot.enqueued = m_enqueued.load(std::memory_order_relaxed);
+    snapshot.dropped = m_dropped.load(std::memory_order_relaxed);
+    snapshot.bytes = m_bytes.load(std::memory_order_relaxed);
+    snapshot.max_depth = m_maxDepth.load(std::memory_order_relaxed);
+    snapshot.blocked = m_blocked.load(std::memory_order_relaxed);
+    snapshot.flushes = m_flushes.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kLatencyBuckets; ++i) {
+        snapshot.flush_latency[i] = m_flushLatency[i].load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+uint64_t LogAppenderMetrics::Snapshot::flushLatencyPercentile(double p) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < kLatencyBuckets; ++i) {
+        total += flush_latency[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = std::max<uint64_t>(1, (uint64_t)std::ceil(p * total));
+    uint64_t count = 0;
+    for (size_t i = 0; i < kLatencyBuckets; ++i) {
+        count += flush_latency[i];
+        if (count >= target) {
+            return 1ull << i;
+        }
+    }
+    return 1ull << (kLatencyBuckets - 1);
+}
+
+BatchLogAppender::~BatchLogAppender() {
+}
+
+void BatchLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) {
+    formatAndLog(logger, level, event);
+}
+
+void BatchLogAppender::logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+        , const std::string& formatted) {
+    if (level < m_level) {
+        return;
+    }
+    MutexType::Lock lock(m_mutex);
+    if (!m_maxBytes) {
+        write(formatted.data(), formatted.size());
+        return;
+    }
+    if (m_batch.empty()) {
+        m_firstTime = GetCurrentMS();
+    }
+    m_batch.append(formatted);
+    ++m_records;
+    if (m_batch.size() >= m_maxBytes || (m_maxRecords && m_records >= m_maxRecords)
+            || level >= LogLevel::FATAL) {
+        flushLocked();
+    }
+}
+
+void BatchLogAppender::setBatch(size_t max_bytes, uint32_t max_records, uint32_t max_delay) {
+    if (max_bytes) {
+        LogCrashHandler::AddAppender(this);
+    } else {
+        LogCrashHandler::DelAppender(this);
+    }
+    {
+        MutexType::Lock lock(m_mutex);
+        flushLocked();
+        m_maxBytes = max_bytes;
+        m_maxRecords = max_records;
+        m_maxDelay = max_delay;
+        m_batch.reserve(max_bytes);
+    }
+    if (max_bytes && max_delay) {
+        GetLogFlusher()->add(this);
+    } else {
+        GetLogFlusher()->del(this);
+    }
+}
+
+void BatchLogAppender::flush() {
+    MutexType::Lock lock(m_mutex);
+    flushLocked();
+}
+
+uint32_t BatchLogAppender::flushExpired(uint64_t now_ms) {
+    MutexType::Lock lock(m_mutex);
+    if (m_batch.empty()) {
+        return m_maxDelay;
+    }
+    uint64_t deadline = m_firstTime + m_maxDelay;
+    if (now_ms >= deadline) {
+        flushLocked();
+        return m_maxDelay;
+    }
+    return deadline - now_ms;
+}
+
+void BatchLogAppender::stopBatch() {
+    if (m_maxBytes && m_maxDelay) {
+        GetLogFlusher()->del(this);
+    }
+    LogCrashHandler::DelAppender(this);
+    flush();
+}
+
+void BatchLogAppender::crashFlush() {
+    if (CrashTryLock(m_mutex)) {
+        if (!m_batch.empty()) {
+            crashWrite(m_batch.data(), m_batch.size());
+            m_batch.clear();
+            m_records = 0;
+        }
+        m_mutex.unlock();
+    }
+}
+
+void BatchLogAppender::flushLocked() {
+    if (!m_batch.empty()) {
+        write(m_batch.data(), m_batch.size());
+        m_batch.clear();
+        m_records = 0;
+    }
+}
+
+void BatchLogAppender::batchToYaml(YAML::Node& node) const {
+    if (m_maxBytes) {
+        node["batch_bytes"] = m_maxBytes;
+        node["batch_records"] = m_maxRecords;
+        node["batch_delay"] = m_maxDelay;
+    }
+}
+
+LogFlusher::LogFlusher() {
+}
+
+void LogFlusher::add(BatchLogAppender* appender) {
+    MutexType::Lock lock(m_mutex);
+    if (std::find(m_appenders.begin(), m_appenders.end(), appender) == m_appenders.end()) {
+        m_appenders.push_back(appender);
+    }
+    if (!m_thread) {
+        m_thread.reset(new Thread(std::bind(&LogFlusher::run, this), "log_flusher"));
+    }
+    m_semaphore.notify();
+}
+
+void LogFlusher::del(BatchLogAppender* appender) {
+    //持有m_mutex时后台线程不会访问appender, 返回后appender可以安全析构
+    MutexType::Lock lock(m_mutex);
+    auto it = std::find(m_appenders.begin(), m_appenders.end(), appender);
+    if (it != m_appenders.end()) {
+        m_appenders.erase(it);
+    }
+}
+
+void LogFlusher::run() {
+    uint32_t wait = 1000;
+    while (true) {
+        m_semaphore.waitFor(wait);
+        uint64_t now = GetCurrentMS();
+        wait = 1000;
+        MutexType::Lock lock(m_mutex);
+        for (auto appender : m_appenders) {
+            wait = std::min(wait, std::max(appender->flushExpired(now), (uint32_t)1));
+        }
+    }
+}
+
+LogFlusher* GetLogFlusher() {
+    static LogFlusher* s_flusher = new LogFlusher;
+    return s_flusher;
+}
+
+FileLogAppender::FileLogAppender(const std::string& filename) : m_filename(filename){
+    m_fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+void FileLogAppender::write(const char* data, size_t len){
+    WriteFully(m_fd, data, len);
+}
+
+void FileLogAppender::crashWrite(const char* data, size_t len){
+    WriteFully(m_fd, data, len);
+}
+
+bool FileLogAppender::reopen(){
+    MutexType::Lock lock(m_mutex);
+    if (m_fd >= 0){
+        ::close(m_fd);
+    }
+
+    //追加打开, 不能截断已有内容
+    m_fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return m_fd >= 0;
+
+}
+
+FileLogAppender::~FileLogAppender(){
+    stopBatch();
+    if (m_fd >= 0){
+        ::close(m_fd);
+    }
+}
+
+std::string FileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "FileLogAppender";
+    if (m_level != LogLevel::UNKONWN){
+        node["level"] = LogLevel::ToString(m_level);
+    }
+
+    if (m_formatter && m_hasFormatter){
+        node["format"] = m_formatter->getPattern();
+    }
+    node["path"] = m_filename;
+    batchToYaml(node);
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+StdoutLogAppender::~StdoutLogAppender() {
+    stopBatch();
+}
+
+//和文件一样直接write(2)到fd; 先把std::cout和stdio缓冲中程序其他地方的输出写出去, 保持先后顺序
+void StdoutLogAppender::write(const char* data, size_t len){
+    std::cout.flush();
+    fflush(stdout);
+    WriteFully(STDOUT_FILENO, data, len);
+}
+
+void StdoutLogAppender::crashWrite(const char* data, size_t len){
+    WriteFully(STDOUT_FILENO, data, len);
+}
+
+std::string StdoutLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "StdoutLogAppender";
+    if (m_level != LogLevel::UNKONWN){
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if (m_formatter && m_hasFormatter){
+        node["format"] = m_formatter->getPattern();
+    }
+    batchToYaml(node);
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+AsyncLogAppender::AsyncLogAppender(size_t buffer_size, uint32_t flush_interval)
+    : m_bufferSize(buffer_size), m_flushInterval(flush_interval) {
+    m_current.reserve(m_bufferSize);
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+    stop();
+}
+
+void AsyncLogAppender::start() {
+    if (m_running.exchange(true)) {
+        return;
+    }
+    m_thread.reset(new Thread(std::bind(&AsyncLogAppender::run, this), "log_async"));
+    LogCrashHandler::AddAppender(this);
+}
+
+void AsyncLogAppender::stop() {
+    if (m_running.exchange(false)) {
+        LogCrashHandler::DelAppender(this);
+        m_semaphore.notify();
+        m_thread->join();
+        m_thread.reset();
+    }
+}
+
+void AsyncLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) {
+    formatAndLog(logger, level, event);
+}
+
+void AsyncLogAppender::logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+        , const std::string& msg) {
+    if (level >= m_level) {
+        bool need_notify = false;
+        {
+            MutexType::Lock lock(m_mutex);
+            //缓冲区为空时总是接受, 避免超长的记录一直等待
+            size_t capacity = getCapacity();
+            while (capacity && m_pendingBytes && m_pendingBytes + msg.size() > capacity && m_running) {
+                if (m_overload == LogOverload::DROP_OLDEST && dropOldest()) {
+                    continue;
+                }
+                if (!waitsOnOverload(level)) {
+                    m_metrics.onDrop();
+                    return;
+                }
+                m_metrics.onBlock();
+                if (!m_current.empty()) {
+                    rotateCurrent();
+                }
+                m_semaphore.notify();
+                waitForSpace(lock);
+            }
+            if (!m_current.empty() && m_current.size() + msg.size() > m_bufferSize) {
+                rotateCurrent();
+                need_notify = true;
+            }
+            m_current.append(msg);
+            ++m_currentRecords;
+            m_pendingBytes += msg.size();
+            m_metrics.onEnqueue(msg.size(), m_pendingBytes);
+        }
+        if (need_notify) {
+            m_semaphore.notify();
+        }
+    }
+}
+
+void AsyncLogAppender::rotateCurrent() {
+    m_buffers.push_back(std::move(m_current));
+    m_bufferRecords.push_back(m_currentRecords);
+    m_currentRecords = 0;
+    if (!m_spares.empty()) {
+        m_current = std::move(m_spares.back());
+        m_spares.pop_back();
+    } else {
+        m_current = std::string();
+    }
+}
+
+bool AsyncLogAppender::dropOldest() {
+    if (!m_buffers.empty()) {
+        m_pendingBytes -= m_buffers.front().size();
+        m_metrics.onDrop(m_bufferRecords.front());
+        if (m_spares.size() < 2) {
+            m_buffers.front().clear();
+            m_spares.push_back(std::move(m_buffers.front()));
+        }
+        m_buffers.pop_front();
+        m_bufferRecords.pop_front();
+        return true;
+    }
+    if (!m_current.empty()) {
+        m_pendingBytes -= m_current.size();
+        m_metrics.onDrop(m_currentRecords);
+        m_current.clear();
+        m_currentRecords = 0;
+        return true;
+    }
+    return false;
+}
+
+//已交给后台线程正在写出的缓冲区不在这里, 可能丢失
+void AsyncLogAppender::crashFlush() {
+    if (CrashTryLock(m_mutex)) {
+        //只清空内容, 不释放内存
+        for (auto& buffer : m_buffers) {
+            crashWrite(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+        crashWrite(m_current.data(), m_current.size());
+        m_current.clear();
+        m_mutex.unlock();
+    }
+}
+
+void AsyncLogAppender::run() {
+    std::vector<std::string> writing;
+    while (true) {
+        bool running = m_running;
+        if (running) {
+            m_semaphore.waitFor(m_flushInterval);
+        }
+        {
+            MutexType::Lock lock(m_mutex);
+            if (!m_current.empty()) {
+                rotateCurrent();
+            }
+            for (auto& buffer : m_buffers) {
+                writing.push_back(std::move(buffer));
+            }
+            m_buffers.clear();
+            m_bufferRecords.clear();
+        }
+
+        if (!writing.empty()) {
+            uint64_t begin = GetCurrentUS();
+            size_t bytes = 0;
+            for (auto& buffer : writing) {
+                writeBuffer(buffer.data(), buffer.size());
+                bytes += buffer.size();
+            }
+            flushOutput();
+            m_metrics.onFlush(GetCurrentUS() - begin);
+
+            //保留两块缓冲区复用, 避免前台线程在锁内分配内存
+            MutexType::Lock lock(m_mutex);
+            m_pendingBytes -= bytes;
+            notifySpace();
+            for (auto& buffer : writing) {
+                if (m_spares.size() >= 2) {
+                    break;
+                }
+                buffer.clear();
+                m_spares.push_back(std::move(buffer));
+            }
+            for (auto& buffer : m_spares) {
+                if (buffer.capacity() < m_bufferSize) {
+                    buffer.reserve(m_bufferSize);
+                }
+            }
+        }
+        writing.clear();
+
+        if (!running) {
+            break;
+        }
+    }
+    //结束后不再等待空间
+    MutexType::Lock lock(m_mutex);
+    notifySpace();
+}
+
+AsyncFileLogAppender::AsyncFileLogAppender(const std::string& filename, size_t buffer_size, uint32_t flush_interval)
+    : AsyncLogAppender(buffer_size, flush_interval), m_filename(filename) {
+    m_fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    start();
+}
+
+AsyncFileLogAppender::~AsyncFileLogAppender() {
+    stop();
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+void AsyncFileLogAppender::writeBuffer(const char* data, size_t len) {
+    WriteFully(m_fd, data, len);
+}
+
+void AsyncFileLogAppender::crashWrite(const char* data, size_t len) {
+    WriteFully(m_fd, data, len);
+}
+
+std::string AsyncFileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "FileLogAppender";
+    if (m_level != LogLevel::UNKONWN){
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if (m_formatter && m_hasFormatter){
+        node["format"] = m_formatter->getPattern();
+    }
+    node["path"] = m_filename;
+    node["async"] = true;
+    node["buffer_size"] = getBufferSize();
+    node["flush_interval"] = getFlushInterval();
+    node["max_buffers"] = getMaxBuffers();
+    node["overload"] = LogOverload::ToString(m_overload);
+    node["overload_level"] = LogLevel::ToString(m_overloadLevel);
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+GzipLogAppender::GzipLogAppender(const std::string& filename, int compress_level
+        , size_t buffer_size, uint32_t flush_interval)
+    : AsyncLogAppender(buffer_size, flush_interval), m_filename(filename)
+    , m_compressLevel(compress_level), m_stream(new z_stream_s()) {
+    m_fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        std::cout << "open gzip log " << m_filename << " failed: " << strerror(errno) << std::endl;
+    }
+    //windowBits加16输出gzip格式
+    if (deflateInit2(m_stream.get(), m_compressLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        std::cout << "deflateInit2 failed, level=" << m_compressLevel << std::endl;
+        m_stream.reset();
+    }
+    m_out.resize(256 * 1024);
+    start();
+}
+
+GzipLogAppender::~GzipLogAppender() {
+    stop();
+    if (m_stream) {
+        deflateOutput(Z_FINISH);
+        deflateEnd(m_stream.get());
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+void GzipLogAppender::writeBuffer(const char* data, size_t len) {
+    if (!m_stream) {
+        return;
+    }
+    m_stream->next_in = (Bytef*)data;
+    m_stream->avail_in = len;
+    deflateOutput(Z_NO_FLUSH);
+    m_rawBytes += len;
+}
+
+void GzipLogAppender::flushOutput() {
+    if (m_stream) {
+        deflateOutput(Z_FULL_FLUSH);
+    }
+}
+
+void GzipLogAppender::deflateOutput(int flush) {
+    //输出缓冲区被填满说明还有未输出的内容
+    do {
+        m_stream->next_out = (Bytef*)&m_out[0];
+        m_stream->avail_out = m_out.size();
+        int rt = deflate(m_stream.get(), flush);
+        if (rt == Z_STREAM_ERROR) {
+            break;
+        }
+        size_t len = m_out.size() - m_stream->avail_out;
+        m_compressedBytes += len;
+        WriteFully(m_fd, m_out.data(), len);
+    } while (m_stream->avail_out == 0);
+}
+
+std::string GzipLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "GzipLogAppender";
+    if (m_level != LogLevel::UNKONWN){
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if (m_formatter && m_hasFormatter){
+        node["format"] = m_formatter->getPattern();
+    }
+    node["path"] = m_filename;
+    node["compress_level"] = m_compressLevel;
+    node["buffer_size"] = getBufferSize();
+    node["flush_interval"] = getFlushInterval();
+    node["max_buffers"] = getMaxBuffers();
+    node["overload"] = LogOverload::ToString(m_overload);
+    node["overload_level"] = LogLevel::ToString(m_overloadLevel);
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+RollingFileLogAppender::RollingFileLogAppender(const std::string& filename, uint64_t max_size
+        , uint32_t rotate_interval, uint32_t max_files)
+    : m_filename(filename), m_nextFilename(filename + ".next"), m_pendingFilename(filename + ".next.tmp")
+    , m_maxSize(max_size), m_rotateInterval(rotate_interval), m_maxFiles(max_files) {
+    m_fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    if (m_fd >= 0 && fstat(m_fd, &st) == 0) {
+        m_size = st.st_size;
+    }
+    if (m_rotateInterval) {
+        m_period = time(0) / m_rotateInterval;
+    }
+
+    //上次运行留下的归档, 名字中的时间保证按字典序即按时间排序
+    glob_t g;
+    std::string pattern = m_filename + ".[0-9]*";
+    if (glob(pattern.c_str(), 0, nullptr, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; ++i) {
+            m_archives.push_back(g.gl_pathv[i]);
+        }
+    }
+    globfree(&g);
+    unlink(m_nextFilename.c_str());
+    unlink(m_pendingFilename.c_str());
+
+    m_running = true;
+    m_thread.reset(new Thread(std::bind(&RollingFileLogAppender::run, this), "log_rolling"));
+    m_semaphore.notify();
+}
+
+RollingFileLogAppender::~RollingFileLogAppender() {
+    if (m_running.exchange(false)) {
+        m_semaphore.notify();
+        m_thread->join();
+    }
+    if (m_nextFd >= 0) {
+        ::close(m_nextFd);
+        unlink(m_nextFilename.c_str());
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+int RollingFileLogAppender::openSegment(const std::string& path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+#ifdef __linux__
+    //只预留磁盘块, 不改变文件长度, 追加写入直接落在预留的空间里
+    if (fd >= 0 && m_maxSize) {
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, m_maxSize);
+    }
+#endif
+    return fd;
+}
+
+std::string RollingFileLogAppender::archiveName(time_t now) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char buf[32];
+    strftime(buf, sizeof(buf), ".%Y%m%d-%H%M%S", &tm);
+    std::string name = m_filename + buf;
+    if (name != m_lastArchive) {
+        m_lastArchive = name;
+        m_archiveSeq = 0;
+    }
+    //同一秒内多次切换时追加序号, 补齐位数保证字典序和时间顺序一致
+    std::string archive = name;
+    while (m_archiveSeq || access(archive.c_str(), F_OK) == 0) {
+        snprintf(buf, sizeof(buf), ".%03u", ++m_archiveSeq);
+        archive = name + buf;
+        if (access(archive.c_str(), F_OK) != 0) {
+            break;
+        }
+    }
+    return archive;
+}
+
+void RollingFileLogAppender::rotate(time_t now) {
+    if (m_nextFd < 0) {
+        //后台线程还没准备好, 只能同步创建
+        m_nextFd = openSegment(m_nextFilename);
+        if (m_nextFd < 0) {
+            return;
+        }
+    }
+    //改名失败时继续写旧文件, 下一次写入再重试
+    std::string archive = archiveName(now);
+    if (rename(m_filename.c_str(), archive.c_str()) != 0) {
+        return;
+    }
+    if (rename(m_nextFilename.c_str(), m_filename.c_str()) != 0) {
+        rename(archive.c_str(), m_filename.c_str());
+        //filename.next已经不可用, 让后台线程重新创建
+        ::close(m_nextFd);
+        m_nextFd = -1;
+        m_semaphore.notify();
+        return;
+    }
+    int fd = m_nextFd;
+    m_nextFd = -1;
+    m_archives.push_back(archive);
+    if (m_fd >= 0) {
+        m_retired.push_back(m_fd);
+    }
+    m_fd = fd;
+    m_size = 0;
+    m_semaphore.notify();
+}
+
+void RollingFileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) {
+    formatAndLog(logger, level, event);
+}
+
+void RollingFileLogAppender::logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+        , const std::string& buf) {
+    if (level >= m_level) {
+        MutexType::Lock lock(m_mutex);
+        time_t now = event->getTime();
+        uint64_t period = m_rotateInterval ? now / m_rotateInterval : 0;
+        if (period > m_period || (m_maxSize && m_size + buf.size() > m_maxSize)) {
+            m_period = std::max(period, m_period);
+            //空文件不需要切换
+            if (m_size) {
+                rotate(now);
+            }
+        }
+        if (m_fd < 0) {
+            return;
+        }
+        const char* data = buf.data();
+        size_t len = buf.size();
+        while (len > 0) {
+            ssize_t n = ::write(m_fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            data += n;
+            len -= n;
+            m_size += n;
+        }
+    }
+}
+
+bool RollingFileLogAppender::reopen() {
+    MutexType::Lock lock(m_mutex);
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+    m_fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    m_size = (m_fd >= 0 && fstat(m_fd, &st) == 0) ? st.st_size : 0;
+    return m_fd >= 0;
+}
+
+void RollingFileLogAppender::run() {
+    std::vector<int> retired;
+    std::vector<std::string> expired;
+    while (m_running) {
+        m_semaphore.wait();
+
+        bool need_next;
+        {
+            MutexType::Lock lock(m_mutex);
+            retired.swap(m_retired);
+            while (m_maxFiles && m_archives.size() > m_maxFiles) {
+                expired.push_back(std::move(m_archives.front()));
+                m_archives.pop_front();
+            }
+            need_next = m_nextFd < 0;
+        }
+
+        //释放预留但没有用到的空间
+        for (int fd : retired) {
+            struct stat st;
+            if (fstat(fd, &st) == 0) {
+                int rt = ftruncate(fd, st.st_size);
+                (void)rt;
+            }
+            ::close(fd);
+        }
+        retired.clear();
+        for (auto& path : expired) {
+            unlink(path.c_str());
+        }
+        expired.clear();
+
+        //不持锁时只碰临时名, rotate()可能正在同步创建filename.next
+        if (need_next && m_running) {
+            int fd = openSegment(m_pendingFilename);
+            if (fd >= 0) {
+                MutexType::Lock lock(m_mutex);
+                if (m_nextFd < 0 && rename(m_pendingFilename.c_str(), m_nextFilename.c_str()) == 0) {
+                    m_nextFd = fd;
+                    fd = -1;
+                }
+            }
+            if (fd >= 0) {
+                ::close(fd);
+                unlink(m_pendingFilename.c_str());
+            }
+        }
+    }
+
+    //退出前处理最后一次切换留下的旧文件和多余的归档
+    MutexType::Lock lock(m_mutex);
+    for (int fd : m_retired) {
+        ::close(fd);
+    }
+    m_retired.clear();
+    while (m_maxFiles && m_archives.size() > m_maxFiles) {
+        unlink(m_archives.front().c_str());
+        m_archives.pop_front();
+    }
+}
+
+std::string RollingFileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "RollingFileLogAppender";
+    if (m_level != LogLevel::UNKONWN){
+        node["level"] = LogLevel::ToString(m_level);
+    }
+
+    if (m_formatter && m_hasFormatter){
+        node["format"] = m_formatter->getPattern();
+    }
+    node["path"] = m_filename;
+    node["max_size"] = m_maxSize;
+    node["rotate_interval"] = m_rotateInterval;
+    node["max_files"] = m_maxFiles;
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+//文件末尾可能有上次未正常关闭时留下的0填充, 找到最后一个非0字节
+static uint64_t DataLength(int fd, uint64_t size) {
+    char buf[64 * 1024];
+    while (size > 0) {
+        size_t len = std::min(size, (uint64_t)sizeof(buf));
+        ssize_t n = pread(fd, buf, len, size - len);
+        if (n != (ssize_t)len) {
+            break;
+        }
+        for (size_t i = len; i > 0; --i) {
+            if (buf[i - 1]) {
+                return size - len + i;
+            }
+        }
+        size -= len;
+    }
+    return 0;
+}
+
+MmapLogAppender::MmapLogAppender(const std::string& filename, size_t chunk_size)
+    : m_filename(filename), m_chunks(new Chunk[kMaxChunks]) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    m_chunkSize = std::max(page, (chunk_size + page - 1) / page * page);
+    m_fd = ::open(m_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) == 0) {
+        m_fileSize = st.st_size;
+        m_cursor = DataLength(m_fd, m_fileSize);
+    }
+    //已有内容所在的块, 之前的字节视为已写入
+    size_t index = m_cursor / m_chunkSize;
+    if (index < kMaxChunks) {
+        m_chunks[index].committed = m_cursor % m_chunkSize;
+        mapChunk(index);
+    }
+}
+
+MmapLogAppender::~MmapLogAppender() {
+    for (size_t i = 0; i < kMaxChunks; ++i) {
+        char* data = m_chunks[i].data;
+        if (data) {
+            munmap(data, m_chunkSize);
+        }
+    }
+    if (m_fd >= 0) {
+        int rt = ftruncate(m_fd, std::min((uint64_t)m_cursor, (uint64_t)kMaxChunks * m_chunkSize));
+        (void)rt;
+        ::close(m_fd);
+    }
+}
+
+char* MmapLogAppender::mapChunk(size_t index) {
+    Mutex::Lock lock(m_mapMutex);
+    //顺便映射下一块, 正常情况下写入线程跨块时不需要再等待
+    for (size_t i = index; i < std::min(index + 2, kMaxChunks); ++i) {
+        Chunk& chunk = m_chunks[i];
+        if (chunk.data || chunk.committed == m_chunkSize) {
+            continue;
+        }
+        uint64_t end = (uint64_t)(i + 1) * m_chunkSize;
+        if (m_fileSize < end) {
+#ifdef __linux__
+            //先分配磁盘空间, 避免磁盘满时写入映射区收到SIGBUS
+            if (fallocate(m_fd, 0, m_fileSize, end - m_fileSize) != 0
+                    && ftruncate(m_fd, end) != 0) {
+                break;
+            }
+#else
+            if (ftruncate(m_fd, end) != 0) {
+                break;
+            }
+#endif
+            m_fileSize = end;
+        }
+        void* data = mmap(nullptr, m_chunkSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, end - m_chunkSize);
+        if (data == MAP_FAILED) {
+            break;
+        }
+        chunk.data.store((char*)data, std::memory_order_release);
+    }
+    return m_chunks[index].data;
+}
+
+void MmapLogAppender::commit(size_t index, size_t len) {
+    Chunk& chunk = m_chunks[index];
+    if (chunk.committed.fetch_add(len, std::memory_order_acq_rel) + len == m_chunkSize) {
+        char* data = chunk.data.exchange(nullptr);
+        if (data) {
+            munmap(data, m_chunkSize);
+        }
+    }
+}
+
+void MmapLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) {
+    formatAndLog(logger, level, event);
+}
+
+void MmapLogAppender::logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+        , const std::string& buf) {
+    if (level < m_level || m_fd < 0) {
+        return;
+    }
+    const char* src = buf.data();
+    size_t len = buf.size();
+    uint64_t offset = m_cursor.fetch_add(len, std::memory_order_relaxed);
+    while (len > 0) {
+        size_t index = offset / m_chunkSize;
+        size_t pos = offset % m_chunkSize;
+        size_t n = std::min(len, m_chunkSize - pos);
+        if (index >= kMaxChunks) {
+            break;
+        }
+        char* data = m_chunks[index].data.load(std::memory_order_acquire);
+        if (!data) {
+            data = mapChunk(index);
+        }
+        if (data) {
+            memcpy(data + pos, src, n);
+        }
+        commit(index, n);
+        offset += n;
+        src += n;
+        len -= n;
+    }
+}
+
+std::string MmapLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "MmapLogAppender";
+    if (m_level != LogLevel::UNKONWN){
+        node["level"] = LogLevel::ToString(m_level);
+    }
+
+    if (m_formatter && m_hasFormatter){
+        node["format"] = m_formatter->getPattern();
+    }
+    node["path"] = m_filename;
+    node["chunk_size"] = m_chunkSize;
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+const char* const BinaryLogAppender::kMagic = "WFBLOG1\n";
+
+BinaryLogAppender::BinaryLogAppender(const std::string& filename) : m_filename(filename) {
+    m_filestream.open(m_filename, std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+    if (m_filestream.tellp() == 0) {
+        m_filestream.write(kMagic, strlen(kMagic));
+    }
+}
+
+BinaryLogAppender::~BinaryLogAppender() {
+    if (m_filestream.is_open()) {
+        m_filestream.close();
+    }
+}
+
+namespace {
+template<class T>
+void PutValue(std::string& buf, T val) {
+    buf.append((const char*)&val, sizeof(val));
+}
+
+void PutString16(std::string& buf, const char* str, size_t len) {
+    uint16_t l = std::min(len, (size_t)UINT16_MAX);
+    PutValue(buf, l);
+    buf.append(str, l);
+}
+}
+
+void BinaryLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) {
+    if (level < m_level) {
+        return;
+    }
+    //只有LOG_FMT_*的事件按调用点编码, 其他事件直接写消息文本
+    const LogSite* site = event->getFmt() ? event->getSite() : nullptr;
+    uint32_t site_id = site ? site->id.load(std::memory_order_acquire) : 0;
+    std::string& buf = GetFormatBuffer();
+
+    MutexType::Lock lock(m_mutex);
+    if (site_id && (site_id >= m_sites.size() || !m_sites[site_id])) {
+        if (site_id >= m_sites.size()) {
+            m_sites.resize(site_id + 1);
+        }
+        m_sites[site_id] = true;
+        buf.push_back('S');
+        PutValue(buf, site_id);
+        PutValue(buf, site->line);
+        PutValue(buf, (uint8_t)level);
+        PutString16(buf, site->file, strlen(site->file));
+        PutValue(buf, (uint32_t)strlen(event->getFmt()));
+        buf.append(event->getFmt());
+    }
+
+    const std::string& name = event->getLogger()->getName();
+    auto it = m_loggers.find(name);
+    if (it == m_loggers.end()) {
+        it = m_loggers.insert(std::make_pair(name, (uint32_t)m_loggers.size() + 1)).first;
+        buf.push_back('L');
+        PutValue(buf, it->second);
+        PutString16(buf, name.c_str(), name.size());
+    }
+
+    buf.push_back('E');
+    PutValue(buf, site_id);
+    PutValue(buf, it->second);
+    PutValue(buf, (uint8_t)level);
+    PutValue(buf, (uint64_t)event->getTime() * 1000000 + event->getUsec());
+    PutValue(buf, event->getElapse());
+    PutValue(buf, event->getThreadId());
+    PutValue(buf, event->getFiberId());
+    PutString16(buf, event->getThreadName().c_str(), event->getThreadName().size());
+    if (site_id) {
+        PutValue(buf, (uint32_t)event->getArgs().size());
+        buf.append(event->getArgs());
+    } else {
+        PutString16(buf, event->getFile(), strlen(event->getFile()));
+        PutValue(buf, event->getLine());
+        PutValue(buf, (uint32_t)event->getContentSize());
+        buf.append(event->getContentData(), event->getContentSize());
+    }
+
+    m_filestream.write(buf.data(), buf.size());
+    //高频调试日志不逐条刷新, 只在出错时刷新
+    if (level >= LogLevel::ERROR) {
+        m_filestream.flush();
+    }
+}
+
+std::string BinaryLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "BinaryLogAppender";
+    if (m_level != LogLevel::UNKONWN){
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    node["path"] = m_filename;
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+//====================== Implementation of Formatter ======================
+LogFormatter::LogFormatter(const std::string &pattern) : m_pattern(pattern){
+    init();
+}
+
+
+//配置日志格式
+//%xxx %xxx{xxx} %%
+/*
+ * %m 消息体
+ * %p level
+ * %r 程序启动到现在的毫秒数(单调时钟)
+ * %c log name
+ * %t thread id
+ * %n return/enter
+ * %d time/date, %d{%H:%M:%S.%ms} / %d{%H:%M:%S.%us} 追加毫秒/微秒
+ * %f file name
+ * %l line #
+ * %J JSON object, %J{...} 指定time字段的格式; 整个pattern为json时等同于%J%n
+ */
+void LogFormatter::init() {
+    //str, format, type
+    std::vector<std::tuple<std::string, std::string, int>> vec;
+    std::string n_str;
+    const std::string pattern = m_pattern == "json" ? "%J%n" : m_pattern;
+
+    for (size_t i=0; i<pattern.size(); i++){
+        //如果是非%字符, 则直接
+        if (pattern[i] != '%'){
+            n_str.append(1, pattern[i]);
+            continue;
+        }
+
+        if ((i+1) < pattern.size()){
+            if (pattern[i + 1] == '%'){
+                n_str.append(1, pattern[i]);
+            }
+        }
+
+        size_t n = i+1;
+        //用于处理大括号中的内容
+        int fmt_status = 0;
+        size_t fmt_begin = 0;
+
+        std::string str;
+        std::string fmt;
+        while (n < pattern.size()){
+            if (!fmt_status && (!isalpha(pattern[n]) && pattern[n] != '{' && pattern[n] != '}')){
+                str = pattern.substr(i+1, n-i-1);
+                break;
+            }
+
+            if (fmt_status == 0){
+                if (pattern[n] == '{'){
+                    str = pattern.substr(i+1, n-i-1);
+                    fmt_status = 1;
+                    fmt_begin = n;
+                    ++n;
+                    continue;
+                }
+
+            }else if (fmt_status == 1){
+                if(pattern[n] == '}'){
+                    fmt = pattern.substr(fmt_begin+1, n-fmt_begin-1);
+                    fmt_status = 0;
+                    ++n;
+                    break;
+                }
+            }
+            ++n;
+            if (n == pattern.size()) {
+                if (str.empty()){
+                    str = pattern.substr(i+1);
+                }
+            }
+        }
+
+        if (fmt_status == 0){
+            if (!n_str.empty()){
+                vec.push_back(std::make_tuple(n_str, "", 0));
+                n_str.clear();
+            }
+            vec.push_back(std::make_tuple(str, fmt, 1));
+            i = n - 1;
+        } else if (fmt_status == 1){
+            std::cout << "pattern parse error: " << pattern << " - " << pattern.substr(i) << std::endl;
+            vec.push_back(std::make_tuple("<<pattern_error>>", fmt, 0));
+            m_error = true;
+        }
+    }
+
+    if (!n_str.empty()){
+        vec.push_back(std::make_tuple(n_str, "", 0));
+    }
+
+    static std::map<std::string, LogFormatter::Op> formatItems = {
+#define XX(str, op) {#str, LogFormatter::op}
+
+    XX(m, MESSAGE),     //m:消息
+    XX(p, LEVEL),       //p:日志级别
+    XX(r, ELAPSE),      //r:累计毫秒数
+    XX(c, NAME),        //c:日志名称
+    XX(t, THREAD_ID),   //t:线程id
+    XX(n, NEWLINE),     //n:换行
+    XX(d, DATETIME),    //d:时间
+    XX(f, FILENAME),    //f:文件名
+    XX(l, LINE),        //l:行号
+    XX(T, TAB),         //T:Tab
+    XX(F, FIBER_ID),    //F:协程id
+    XX(N, THREAD_NAME), //N:线程名称
+    XX(J, JSON)         //J:JSON
+#undef XX
+    };
+
+    for(auto& i : vec){
+        if (std::get<2>(i) == 0){
+            m_items.push_back(Item{STRING, std::get<0>(i), nullptr});
+        } else {
+            auto it = formatItems.find(std::get<0>(i));
+            if (it == formatItems.end()){
+                m_items.push_back(Item{STRING, "<<error_format %" + std::get<0>(i) + ">>", nullptr});
+                m_error = true;
+            } else if (it->second == DATETIME) {
+                m_items.push_back(Item{DATETIME, "", std::make_shared<DateTimeFormat>(std::get<1>(i))});
+            } else if (it->second == JSON) {
+                const std::string& fmt = std::get<1>(i);
+                m_items.push_back(Item{JSON, "", std::make_shared<DateTimeFormat>(fmt.empty() ? kJsonDateFormat : fmt)});
+            } else {
+                m_items.push_back(Item{it->second, "", nullptr});
+            }
+        }
+        //for tests: display parse result
+        //std::cout << '(' << std::get<0>(i) << ") - (" << std::get<1>(i) << ") - (" << std::get<2>(i) << ')' << std::endl;
+    }
+
+}
+
+std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) {
+    std::string buf;
+    format(buf, logger, level, event);
+    return buf;
+}
+
+void LogFormatter::format(std::string& buf, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::pointer& event) {
+    if (m_static) {
+        m_static(buf, level, *event);
+        return;
+    }
+
+    size_t width = 0;
+    for (auto& item : m_items){
+        switch (item.op) {
+            case STRING:
+                Append(buf, width, item.str.c_str(), item.str.size());
+                break;
+            case MESSAGE:
+                Append(buf, width, event->getContentData(), event->getContentSize());
+                break;
+            case LEVEL: {
+                const char* name = LogLevel::ToString(level);
+                Append(buf, width, name, strlen(name));
+                break;
+            }
+            case ELAPSE:
+                AppendNumber(buf, width, event->getElapse());
+                break;
+            case NAME: {
+                const std::string& name = event->getLogger()->getName();
+                Append(buf, width, name.c_str(), name.size());
+                break;
+            }
+            case THREAD_ID:
+                AppendNumber(buf, width, event->getThreadId());
+                break;
+            case NEWLINE:
+                AppendNewLine(buf, width);
+                break;
+            case DATETIME:
+                AppendDateTime(buf, width, *item.date, event->getTime(), event->getUsec());
+                break;
+            case FILENAME:
+                Append(buf, width, event->getFile(), strlen(event->getFile()));
+                break;
+            case LINE:
+                AppendNumber(buf, width, event->getLine());
+                break;
+            case TAB:
+                AppendTab(buf, width);
+                break;
+            case FIBER_ID:
+                AppendNumber(buf, width, event->getFiberId());
+                break;
+            case THREAD_NAME:
+                Append(buf, width, event->getThreadName().c_str(), event->getThreadName().size());
+                break;
+            case JSON:
+                AppendJson(buf, width, *item.date, level, *event);
+                break;
+        }
+    }
+}
+
+//====================== Implementation of LoggerManager ======================
+
+LoggerManager::LoggerManager(){
+    m_root.reset(new Logger());
+    m_root->addAppender(LogAppender::pointer(new StdoutLogAppender()));
+
+    std::shared_ptr<LoggerMap> loggers = std::make_shared<LoggerMap>();
+    (*loggers)[m_root->getName()] = m_root;
+    m_loggers = std::move(loggers);
+    init();
+}
+
+namespace {
+//LoggerManager::getLogger使用的线程局部名字表快照
+struct LoggerMapCache {
+    const LoggerManager* manager = nullptr;
+    uint64_t version = 0;
+    std::shared_ptr<const LoggerManager::LoggerMap> loggers;
+};
+}
+
+Logger::pointer LoggerManager::getLogger(const std::string& name){
+    static thread_local LoggerMapCache t_cache;
+    uint64_t version = m_version.load(std::memory_order_acquire);
+    if (t_cache.manager != this || t_cache.version != version || !t_cache.loggers) {
+        t_cache.loggers = std::atomic_load(&m_loggers);
+        t_cache.manager = this;
+        t_cache.version = version;
+    }
+    auto it = t_cache.loggers->find(name);
+    if (it != t_cache.loggers->end()){
+        return it->second;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    std::shared_ptr<const LoggerMap> current = std::atomic_load(&m_loggers);
+    it = current->find(name);
+    if (it != current->end()){
+        return it->second;
+    }
+    std::shared_ptr<LoggerMap> loggers = std::make_shared<LoggerMap>(*current);
+    Logger::pointer new_logger = getOrCreateLocked(*loggers, name);
+    std::vector<Logger::pointer> created;
+    for (auto& i : *loggers) {
+        if (current->find(i.first) == current->end()) {
+            created.push_back(i.second);
+        }
+    }
+    std::atomic_store(&m_loggers, std::shared_ptr<const LoggerMap>(std::move(loggers)));
+    m_version.fetch_add(1, std::memory_order_release);
+    lock.unlock();
+    //MatchLogger会加规则锁, 规则更新时又会调用getLoggers, 所以在释放m_mutex后再设置
+    for (auto& logger : created) {
+        logger->setDebugForced(LogSite::MatchLogger(logger->getName()));
+    }
+    return new_logger;
+}
+
+Logger::pointer LoggerManager::getOrCreateLocked(LoggerMap& map, const std::string& name) {
+    auto it = map.find(name);
+    if (it != map.end()){
+        return it->second;
+    }
+    size_t pos = name.rfind('.');
+    Logger::pointer parent = (pos == std::string::npos || pos == 0) ? m_root
+            : getOrCreateLocked(map, name.substr(0, pos));
+    Logger::pointer new_logger(new Logger(name));
+    new_logger->m_level = LogLevel::UNKONWN;
+    {
+        Logger::MutexType::Lock lock(Logger::TreeMutex());
+        new_logger->m_parent = parent;
+        parent->m_children.push_back(new_logger.get());
+        new_logger->resolveLocked();
     }
+    map[name] = new_logger;
+    return new_logger;
 }
 
-LogEvent::~LogEvent() {
-
+std::vector<Logger::pointer> LoggerManager::getLoggers() {
+    std::vector<Logger::pointer> loggers;
+    for (auto& i : *std::atomic_load(&m_loggers)) {
+        loggers.push_back(i.second);
+    }
+    return loggers;
 }
 
-LogEventWrap::LogEventWrap(LogEvent::pointer event) : m_event(event){
+//====================== Implementation of LogPipeline ======================
 
+static uint64_t MonotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
-LogEventWrap::~LogEventWrap(){
+//head只由收集线程修改, tail只由所属线程修改, 中间填充避免伪共享
+struct LogPipeline::Ring {
+    struct Slot {
+        uint64_t ts = 0;
+        LogEvent::pointer event;
+    };
 
-    m_event->getLogger()->log(m_event->getLevel(), m_event);
-}
+    explicit Ring(size_t capacity) : slots(capacity), mask(capacity - 1) {
+    }
 
-//====================== Implementation of LogFormatter::FormatItem ======================
-class MessageFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << event->getContent();
+    bool push(uint64_t ts, const LogEvent::pointer& event) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) {
+            return false;
+        }
+        Slot& slot = slots[t & mask];
+        slot.ts = ts;
+        slot.event = event;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
     }
-};
 
-class LevelFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << LogLevel::ToString(level);
+    Slot* front() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots[h & mask];
     }
-};
 
-class ElapseFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << event->getElapse();
+    void pop() {
+        size_t h = head.load(std::memory_order_relaxed);
+        slots[h & mask].event.reset();
+        head.store(h + 1, std::memory_order_release);
     }
+
+    std::vector<Slot> slots;
+    size_t mask;
+    char pad0[64];
+    std::atomic<size_t> head = {0};
+    char pad1[64];
+    std::atomic<size_t> tail = {0};
+    //所属线程正在检查是否启用并写入, stop()等它变为false后才做最后一次drain
+    std::atomic<bool> pushing = {false};
+    char pad2[64];
+    //所属线程已退出, 队列为空后即可回收
+    std::atomic<bool> closed = {false};
 };
 
-class NameFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << event->getLogger()->getName();
+namespace {
+struct LogRingHolder {
+    std::shared_ptr<LogPipeline::Ring> ring;
+
+    ~LogRingHolder() {
+        if (ring) {
+            ring->closed = true;
+        }
     }
 };
+}
 
-class ThreadIdFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << event->getThreadId();
-    }
+static thread_local LogRingHolder t_log_ring;
+
+//多个协程线程压入, 收集线程一次取走整个链表
+struct LogPipeline::OverflowNode {
+    uint64_t ts;
+    LogEvent::pointer event;
+    OverflowNode* next;
 };
 
-class FiberFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << event->getFiberId();
+std::atomic<bool> LogPipeline::s_enabled = {false};
+std::atomic<bool> LogPipeline::s_fiberOffload = {false};
+
+LogPipeline::LogPipeline() {
+}
+
+LogPipeline::~LogPipeline() {
+    stop();
+}
+
+void LogPipeline::start(size_t ring_size) {
+    startCollector(ring_size);
+    s_enabled = true;
+}
+
+void LogPipeline::startCollector(size_t ring_size) {
+    MutexType::Lock lock(m_mutex);
+    if (m_running) {
+        return;
     }
-};
+    size_t size = 2;
+    while (size < ring_size) {
+        size <<= 1;
+    }
+    m_ringSize = size;
+    m_running = true;
+    m_thread.reset(new Thread(std::bind(&LogPipeline::run, this), "log_pipeline"));
+}
 
-class ThreadNameFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << event->getThreadName();
+void LogPipeline::stop() {
+    Thread::pointer thread;
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        s_enabled = false;
+        m_running = false;
+        thread.swap(m_thread);
+        //之后创建的队列, 所属线程一定能看到上面的false, 不会再写入
+        rings = m_rings;
     }
-};
+    m_semaphore.notify();
+    thread->join();
 
-class DateTimeFormatItem : public LogFormatter::FormatItem{
-public:
-    explicit DateTimeFormatItem(const std::string& format = "%Y-%m-%d %H:%M:%S") : m_format(format){
-        if (m_format.empty()){
-            m_format = "%Y-%m-%d %H:%M:%S";
+    //已经通过检查的线程可能还在写入, 等它们完成后再输出剩余的事件
+    for (auto& ring : rings) {
+        while (ring->pushing.load()) {
+            sched_yield();
         }
     }
+    drain(rings);
+}
 
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64] = {0};
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
+std::shared_ptr<LogPipeline::Ring> LogPipeline::createRing() {
+    MutexType::Lock lock(m_mutex);
+    std::shared_ptr<Ring> ring = std::make_shared<Ring>(m_ringSize);
+    m_rings.push_back(ring);
+    ++m_ringsVersion;
+    return ring;
+}
+
+//不内联, 避免编译器在协程切换前后复用同一个线程局部变量的地址
+__attribute__((noinline)) LogPipeline::Ring* LogPipeline::threadRing() {
+    if (!t_log_ring.ring) {
+        t_log_ring.ring = createRing();
     }
+    return t_log_ring.ring.get();
+}
 
-private:
-    std::string m_format;
-};
+void LogPipeline::wakeCollector() {
+    if (m_sleeping.load(std::memory_order_relaxed) && m_sleeping.exchange(false)) {
+        m_semaphore.notify();
+    }
+}
 
-class FilenameFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << event->getFile();
+bool LogPipeline::push(const LogEvent::pointer& event) {
+    if (!s_enabled.load(std::memory_order_relaxed)) {
+        return false;
     }
-};
+    Ring* ring = threadRing();
+    //先标记再检查(都是seq_cst): 检查时仍为true, stop()就一定会等到这次写入完成
+    ring->pushing.store(true);
+    bool pushed = s_enabled.load() && ring->push(MonotonicNs(), event);
+    ring->pushing.store(false, std::memory_order_release);
+    if (!pushed) {
+        return false;
+    }
+    wakeCollector();
+    return true;
+}
 
-class LineFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << event->getLine();
+void LogPipeline::pushFromFiber(const LogEvent::pointer& event) {
+    Ring* ring = threadRing();
+    ring->pushing.store(true);
+    while (!m_running.load()) {
+        ring->pushing.store(false, std::memory_order_release);
+        startCollector(m_ringSize);
+        ring->pushing.store(true);
     }
-};
+    uint64_t ts = MonotonicNs();
+    if (!ring->push(ts, event)) {
+        //在LogEventWrap的析构中调用, 不能让出协程, 也不能回到appender的锁上等待
+        if (m_overflowSize.fetch_add(1, std::memory_order_relaxed) >= m_ringSize) {
+            --m_overflowSize;
+            ++m_fiberDrops;
+        } else {
+            ++m_fiberOverflows;
+            OverflowNode* node = new OverflowNode{ts, event, m_overflow.load(std::memory_order_relaxed)};
+            while (!m_overflow.compare_exchange_weak(node->next, node
+                    , std::memory_order_release, std::memory_order_relaxed)) {
+            }
+        }
+        m_sleeping = false;
+        m_semaphore.notify();
+    } else {
+        wakeCollector();
+    }
+    ring->pushing.store(false, std::memory_order_release);
+}
 
-class NewLineFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << std::endl;
+void LogPipeline::takeOverflow(std::vector<std::pair<uint64_t, LogEvent::pointer>>& events) {
+    OverflowNode* node = m_overflow.exchange(nullptr, std::memory_order_acquire);
+    size_t count = 0;
+    while (node) {
+        events.emplace_back(node->ts, std::move(node->event));
+        OverflowNode* next = node->next;
+        delete node;
+        node = next;
+        ++count;
     }
-};
+    m_overflowSize -= count;
+    //链表是后进先出的
+    std::reverse(events.begin(), events.end());
+    std::stable_sort(events.begin(), events.end()
+            , [](const std::pair<uint64_t, LogEvent::pointer>& a, const std::pair<uint64_t, LogEvent::pointer>& b){
+        return a.first < b.first;
+    });
+}
 
-class StringFormatItem : public LogFormatter::FormatItem{
-public:
-    explicit StringFormatItem(const std::string& str) : FormatItem(str), m_string(str){}
+size_t LogPipeline::drain(std::vector<std::shared_ptr<Ring>>& rings) {
+    std::vector<std::pair<uint64_t, LogEvent::pointer>> overflow;
+    if (m_overflow.load(std::memory_order_relaxed)) {
+        takeOverflow(overflow);
+    }
+    size_t overflow_pos = 0;
+    size_t count = 0;
+    while (true) {
+        Ring* next = nullptr;
+        Ring::Slot* next_slot = nullptr;
+        for (auto& ring : rings) {
+            Ring::Slot* slot = ring->front();
+            if (slot && (!next_slot || slot->ts < next_slot->ts)) {
+                next = ring.get();
+                next_slot = slot;
+            }
+        }
+        LogEvent::pointer event;
+        //溢出链表作为另一个按时间戳有序的来源参与归并
+        if (overflow_pos < overflow.size() && (!next_slot || overflow[overflow_pos].first < next_slot->ts)) {
+            event.swap(overflow[overflow_pos++].second);
+        } else if (next) {
+            event.swap(next_slot->event);
+            next->pop();
+        } else {
+            break;
+        }
+        event->getLogger()->log(event->getLevel(), event);
+        ++count;
+    }
+    return count;
+}
+
+void LogPipeline::run() {
+    std::vector<std::shared_ptr<Ring>> rings;
+    uint64_t version = -1;
+    while (m_running) {
+        if (version != m_ringsVersion) {
+            MutexType::Lock lock(m_mutex);
+            //回收所属线程已退出且已清空的队列
+            for (auto it = m_rings.begin(); it != m_rings.end();) {
+                if ((*it)->closed && !(*it)->front()) {
+                    it = m_rings.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            version = m_ringsVersion;
+            rings = m_rings;
+        }
 
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << m_string;
+        if (drain(rings) == 0) {
+            //没有新事件时休眠, 错过的唤醒最多延迟一个超时周期
+            m_sleeping = true;
+            m_semaphore.waitFor(10);
+            m_sleeping = false;
+            //顺带检查是否有线程退出
+            for (auto& ring : rings) {
+                if (ring->closed) {
+                    ++m_ringsVersion;
+                    break;
+                }
+            }
+        }
     }
+    drain(rings);
+}
 
-private:
-    std::string m_string;
-};
+//====================== Implementation of LogCrashHandler ======================
 
-class TabFormatItem : public LogFormatter::FormatItem{
-public:
-    using LogFormatter::FormatItem::FormatItem;
-    void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override {
-        os << '\t' << std::right << std::setw(5);
+std::atomic<bool> LogCrashHandler::s_installed = {false};
+
+//只由所属线程写入; 线程退出后保留内容, 由之后新建的线程复用
+struct LogCrashHandler::Ring {
+    struct Slot {
+        uint64_t time_us;
+        uint8_t level;
+        uint16_t len;
+        char text[kTextSize];
+    };
+
+    explicit Ring(uint32_t size_) : size(size_), slots(new Slot[size_]) {
     }
 
-private:
-    std::string m_string;
+    std::atomic<bool> in_use = {true};
+    uint32_t thread_id = 0;
+    char thread_name[32] = {0};
+    const uint32_t size;
+    std::atomic<uint64_t> count = {0}; //写入过的总条数
+    std::unique_ptr<Slot[]> slots;
 };
 
-//====================== Implementation of LogFormatter::FormatItem ======================
+static const int s_crash_signals[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+static const size_t kCrashSignalCount = sizeof(s_crash_signals) / sizeof(s_crash_signals[0]);
+static struct sigaction s_crash_old_actions[kCrashSignalCount];
+static std::atomic<LogAppender*> s_crash_appenders[LogCrashHandler::kMaxAppenders];
+//只追加, 信号处理函数不加锁遍历
+static std::atomic<LogCrashHandler::Ring*> s_crash_rings[LogCrashHandler::kMaxRings];
+static std::atomic<size_t> s_crash_ring_count = {0};
+static std::atomic<uint32_t> s_crash_ring_size = {32};
+static std::atomic<int> s_crash_fd = {STDERR_FILENO};
 
-const char* LogLevel::ToString(LogLevel::Level level) {
-    switch (level){
-#define OUTPUT(name) \
-        case LogLevel::name: \
-            return #name; \
-            break;
+struct CrashRingHolder {
+    LogCrashHandler::Ring* ring = nullptr;
 
-        OUTPUT(DEBUG);
-        OUTPUT(INFO);
-        OUTPUT(WARN);
-        OUTPUT(ERROR);
-        OUTPUT(FATAL);
-#undef OUTPUT
-        default:
-            return "UNKNOWN";
+    ~CrashRingHolder() {
+        if (ring) {
+            ring->in_use.store(false, std::memory_order_release);
+        }
     }
-    return "UNKNOWN";
-}
+};
 
-LogLevel::Level LogLevel::FromString(const std::string& str){
-#define OUTPUT(level, val) \
-    if (#val == str) \
-        return LogLevel::level
+static thread_local CrashRingHolder t_crash_ring;
 
-    OUTPUT(DEBUG, debug);
-    OUTPUT(INFO, info);
-    OUTPUT(WARN, warn);
-    OUTPUT(ERROR, error);
-    OUTPUT(FATAL, fatal);
+static LogCrashHandler::Ring* GetCrashRing() {
+    if (t_crash_ring.ring) {
+        return t_crash_ring.ring;
+    }
+    uint32_t size = s_crash_ring_size;
+    LogCrashHandler::Ring* ring = nullptr;
+    size_t count = std::min(s_crash_ring_count.load(std::memory_order_acquire), LogCrashHandler::kMaxRings);
+    for (size_t i = 0; i < count && !ring; ++i) {
+        LogCrashHandler::Ring* r = s_crash_rings[i].load(std::memory_order_acquire);
+        bool in_use = false;
+        if (r && r->size == size && r->in_use.compare_exchange_strong(in_use, true)) {
+            ring = r;
+            ring->count = 0;
+        }
+    }
+    if (!ring) {
+        ring = new LogCrashHandler::Ring(size);
+        size_t index = s_crash_ring_count.fetch_add(1);
+        //超出上限的线程仍然记录, 但崩溃时不会输出
+        if (index < LogCrashHandler::kMaxRings) {
+            s_crash_rings[index].store(ring, std::memory_order_release);
+        }
+    }
+    ring->thread_id = GetThreadId();
+    strncpy(ring->thread_name, Thread::GetName().c_str(), sizeof(ring->thread_name) - 1);
+    t_crash_ring.ring = ring;
+    return ring;
+}
 
-    OUTPUT(DEBUG, DEBUG);
-    OUTPUT(INFO, INFO);
-    OUTPUT(WARN, WARN);
-    OUTPUT(ERROR, ERROR);
-    OUTPUT(FATAL, FATAL);
+void LogCrashHandler::Record(const LogEvent& event) {
+    Ring* ring = GetCrashRing();
+    uint64_t n = ring->count.load(std::memory_order_relaxed);
+    Ring::Slot& slot = ring->slots[n % ring->size];
+    slot.time_us = event.getTime() * 1000000 + event.getUsec();
+    slot.level = event.getLevel();
 
-#undef OUTPUT
-    return LogLevel::UNKONWN;
+    char* ptr = slot.text;
+    char* end = slot.text + kTextSize;
+    auto put = [&ptr, end](const char* str, size_t len) {
+        len = std::min(len, (size_t)(end - ptr));
+        memcpy(ptr, str, len);
+        ptr += len;
+    };
+    const std::string& name = event.getLogger()->getName();
+    char line[16];
+    int line_len = snprintf(line, sizeof(line), ":%d ", event.getLine());
+    put("[", 1);
+    put(name.data(), name.size());
+    put("] ", 2);
+    put(event.getFile(), strlen(event.getFile()));
+    put(line, line_len);
+    put(event.getContentData(), event.getContentSize());
+    slot.len = ptr - slot.text;
+    ring->count.store(n + 1, std::memory_order_release);
 }
 
-//====================== Implementation of Logger ======================
+void LogCrashHandler::AddAppender(LogAppender* appender) {
+    for (auto& slot : s_crash_appenders) {
+        if (slot.load() == appender) {
+            return;
+        }
+    }
+    for (auto& slot : s_crash_appenders) {
+        LogAppender* empty = nullptr;
+        if (slot.compare_exchange_strong(empty, appender)) {
+            return;
+        }
+    }
+}
 
-Logger::Logger(const std::string& name) : m_name(name), m_level(LogLevel::DEBUG) {
-    m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+void LogCrashHandler::DelAppender(LogAppender* appender) {
+    for (auto& slot : s_crash_appenders) {
+        LogAppender* expected = appender;
+        slot.compare_exchange_strong(expected, nullptr);
+    }
 }
 
-void Logger::log(LogLevel::Level level, LogEvent::pointer event){
-    //需要Logger类继承std::enable_shared_from_this<Logger> 避免两个不同的shared_ptr 指向同一个对象，重复销毁
-    auto self = shared_from_this();
-    if (level >= m_level){
-        MutexType::Lock lock(m_mutex);
-        if (! m_appenders.empty()){
-            for (auto& appender : m_appenders){
-                appender->log(self, level, event);
+//信号处理函数中使用的输出, 不分配内存, 缓冲区写满时直接write
+class SignalSafeWriter {
+public:
+    explicit SignalSafeWriter(int fd) : m_fd(fd) {
+    }
+
+    ~SignalSafeWriter() {
+        flush();
+    }
+
+    SignalSafeWriter& append(const char* str, size_t len) {
+        while (len > 0) {
+            size_t n = std::min(len, sizeof(m_buf) - m_size);
+            memcpy(m_buf + m_size, str, n);
+            m_size += n;
+            str += n;
+            len -= n;
+            if (m_size == sizeof(m_buf)) {
+                flush();
             }
-        } else {
-            m_root->log(level, event);
         }
+        return *this;
     }
-}
 
-void Logger::debug(LogEvent::pointer event){
-    log(LogLevel::DEBUG, event);
-}
-void Logger::info(LogEvent::pointer event){
-    log(LogLevel::INFO, event);
-}
-void Logger::warn(LogEvent::pointer event){
-    log(LogLevel::WARN, event);
-}
-void Logger::error(LogEvent::pointer event){
-    log(LogLevel::ERROR, event);
-}
-void Logger::fatal(LogEvent::pointer event){
-    log(LogLevel::FATAL, event);
-}
+    SignalSafeWriter& append(const char* str) {
+        return append(str, strlen(str));
+    }
 
-void Logger::addAppender(LogAppender::pointer appender){
-    MutexType::Lock lock(m_mutex);
-    if(!appender->getFormatter()){
-        appender->setFormatter(m_formatter, false);
+    SignalSafeWriter& number(uint64_t val, int width = 0) {
+        char tmp[24];
+        char* end = tmp + sizeof(tmp);
+        char* ptr = end;
+        do {
+            *--ptr = '0' + val % 10;
+            val /= 10;
+        } while (val);
+        while (end - ptr < width) {
+            *--ptr = '0';
+        }
+        return append(ptr, end - ptr);
+    }
+
+    //UTC时间, localtime_r需要读取时区文件, 不能在信号处理函数中使用
+    SignalSafeWriter& time(uint64_t time_us) {
+        uint64_t secs = time_us / 1000000;
+        int64_t days = secs / 86400;
+        uint32_t rem = secs % 86400;
+        //civil_from_days, 见 http://howardhinnant.github.io/date_algorithms.html
+        days += 719468;
+        int64_t era = days / 146097;
+        uint32_t doe = days - era * 146097;
+        uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        uint32_t mp = (5 * doy + 2) / 153;
+        uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+        uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+        uint64_t year = yoe + era * 400 + (month <= 2);
+        number(year, 4).append("-").number(month, 2).append("-").number(day, 2).append(" ");
+        number(rem / 3600, 2).append(":").number(rem / 60 % 60, 2).append(":").number(rem % 60, 2);
+        return append(".").number(time_us % 1000000, 6).append("Z");
+    }
+
+    void flush() {
+        WriteFully(m_fd, m_buf, m_size);
+        m_size = 0;
+    }
+private:
+    int m_fd;
+    char m_buf[1024];
+    size_t m_size = 0;
+};
+
+static const char* CrashSignalName(int sig) {
+    switch (sig) {
+        case SIGSEGV: return "SIGSEGV";
+        case SIGABRT: return "SIGABRT";
+        case SIGBUS: return "SIGBUS";
+        case SIGFPE: return "SIGFPE";
+        case SIGILL: return "SIGILL";
+        default: return "signal";
     }
-    m_appenders.push_back(appender);
 }
-void Logger::delAppender(LogAppender::pointer appender){
-    MutexType::Lock lock(m_mutex);
-    for(auto iter = m_appenders.begin(); iter != m_appenders.end(); iter++){
-        if(*iter == appender){
-            m_appenders.erase(iter);
-            break;
+
+void LogCrashHandler::Dump(int sig) {
+    //先写出各appender的缓冲区, 这些内容在对应的文件中保持原有顺序
+    for (auto& slot : s_crash_appenders) {
+        LogAppender* appender = slot.load(std::memory_order_acquire);
+        if (appender) {
+            appender->crashFlush();
+        }
+    }
+
+    int fd = s_crash_fd;
+    {
+        SignalSafeWriter out(fd);
+        if (sig) {
+            out.append("*** ").append(CrashSignalName(sig)).append(" (").number(sig).append(") received by thread ")
+               .number(GetThreadId()).append(" at ").time(GetCurrentUS()).append(" ***\n");
         }
+        size_t count = std::min(s_crash_ring_count.load(std::memory_order_acquire), kMaxRings);
+        for (size_t i = 0; i < count; ++i) {
+            Ring* ring = s_crash_rings[i].load(std::memory_order_acquire);
+            uint64_t n = ring ? ring->count.load(std::memory_order_acquire) : 0;
+            if (n == 0) {
+                continue;
+            }
+            uint64_t begin = n > ring->size ? n - ring->size : 0;
+            out.append("--- thread ").number(ring->thread_id).append(" ").append(ring->thread_name)
+               .append(ring->in_use ? "" : " (exited)").append(", last ").number(n - begin)
+               .append(" of ").number(n).append(" events ---\n");
+            for (uint64_t j = begin; j < n; ++j) {
+                const Ring::Slot& slot = ring->slots[j % ring->size];
+                out.time(slot.time_us).append(" ").append(LogLevel::ToString((LogLevel::Level)slot.level))
+                   .append(" ").append(slot.text, std::min((size_t)slot.len, kTextSize)).append("\n");
+            }
+        }
+        out.append("backtrace:\n");
     }
+    void* frames[64];
+    int frame_count = backtrace(frames, 64);
+    backtrace_symbols_fd(frames, frame_count, fd);
 }
 
-void Logger::clearAppender() {
-    MutexType::Lock lock(m_mutex);
-    m_appenders.clear();
+static void OnCrashSignal(int sig, siginfo_t* info, void* context) {
+    static std::atomic<bool> s_crashing = {false};
+    if (s_crashing.exchange(true)) {
+        //其他线程同时崩溃, 等第一个线程输出完后结束进程
+        while (true) {
+            pause();
+        }
+    }
+    LogCrashHandler::Dump(sig);
+    //恢复原来的处理方式, 信号处理函数返回后再次收到信号, 按原方式处理(默认为结束进程并生成core)
+    for (size_t i = 0; i < kCrashSignalCount; ++i) {
+        sigaction(s_crash_signals[i], &s_crash_old_actions[i], nullptr);
+    }
+    raise(sig);
 }
 
-void Logger::setFormatter(LogFormatter::pointer val){
-    MutexType::Lock lock(m_mutex);
-    m_formatter = val;
+static Mutex s_crash_mutex;
 
-    for(auto& appender : m_appenders){
-        //Mutex::Lock appender_lock(appender->m_mutex);
-        if (!appender->hasFormatter()){
-            appender->setFormatter(val, false);
+void LogCrashHandler::Install(uint32_t ring_size, const std::string& path) {
+    Mutex::Lock lock(s_crash_mutex);
+    s_crash_ring_size = std::max(ring_size, (uint32_t)1);
+    int fd = STDERR_FILENO;
+    if (!path.empty()) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cout << "open crash log " << path << " failed: " << strerror(errno) << std::endl;
+            fd = STDERR_FILENO;
         }
     }
+    int old_fd = s_crash_fd.exchange(fd);
+    if (old_fd != STDERR_FILENO) {
+        ::close(old_fd);
+    }
+    if (s_installed) {
+        return;
+    }
+
+    //第一次调用backtrace会加载libgcc并分配内存, 不能留到信号处理函数中
+    void* frame;
+    backtrace(&frame, 1);
+
+    //栈溢出时在备用栈上执行信号处理函数, 只对调用Install的线程有效
+    static char s_alt_stack[64 * 1024];
+    stack_t stack;
+    stack.ss_sp = s_alt_stack;
+    stack.ss_size = sizeof(s_alt_stack);
+    stack.ss_flags = 0;
+    sigaltstack(&stack, nullptr);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = OnCrashSignal;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < kCrashSignalCount; ++i) {
+        sigaction(s_crash_signals[i], &action, &s_crash_old_actions[i]);
+    }
+    s_installed = true;
 }
 
-void Logger::setFormatter(const std::string& val){
-    LogFormatter::pointer new_formatter(new LogFormatter(val));
-    if (new_formatter->isError()){
-        std::cout << "Logger setFormatter name = " << m_name
-                  << " value = " << val << " invalid formatter\n";
+void LogCrashHandler::Uninstall() {
+    Mutex::Lock lock(s_crash_mutex);
+    if (!s_installed) {
         return;
     }
-    setFormatter(new_formatter);
+    for (size_t i = 0; i < kCrashSignalCount; ++i) {
+        sigaction(s_crash_signals[i], &s_crash_old_actions[i], nullptr);
+    }
+    s_installed = false;
 }
 
-std::string Logger::toYamlString() {
-    MutexType::Lock lock(m_mutex);
-    YAML::Node node;
-    node["name"] = m_name;
-    node["level"] = LogLevel::ToString(m_level);
-    if (m_formatter){
-        node["format"] = m_formatter->getPattern();
+//====================== Implementation of MemoryRingLogAppender ======================
+
+//记录格式: u32 len, u64 time_us, u8 level, text
+static const size_t kMemoryRecordHeader = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint8_t);
+
+struct MemoryRingLogAppender::Ring {
+    explicit Ring(size_t capacity_) : capacity(capacity_), data(new char[capacity_]) {
     }
 
-    for(auto& i : m_appenders){
-        node["appenders"].push_back(YAML::Load(i->toYamlString()));
+    //pos为累计偏移, 处理跨过缓冲区末尾的情况
+    void put(uint64_t pos, const char* src, size_t len) {
+        size_t offset = pos % capacity;
+        size_t n = std::min(len, capacity - offset);
+        memcpy(&data[offset], src, n);
+        memcpy(&data[0], src + n, len - n);
     }
 
-    std::stringstream ss;
-    ss << node;
-    return ss.str();
+    void get(uint64_t pos, char* dst, size_t len) const {
+        size_t offset = pos % capacity;
+        size_t n = std::min(len, capacity - offset);
+        memcpy(dst, &data[offset], n);
+        memcpy(dst + n, &data[0], len - n);
+    }
+
+    Spinlock mutex;
+    uint32_t thread_id = 0;
+    char thread_name[32] = {0};
+    const size_t capacity;
+    std::unique_ptr<char[]> data;
+    uint64_t head = 0; //最早一条记录的位置
+    uint64_t tail = 0; //下一条记录的位置
+};
+
+//每个线程缓存最近使用的几个appender的缓冲区, 按appender的id匹配, appender析构后不会再被匹配到
+struct MemoryRingCache {
+    uint64_t id = 0;
+    MemoryRingLogAppender::Ring* ring = nullptr;
+};
+
+static thread_local MemoryRingCache t_memory_ring_cache[4];
+static thread_local uint32_t t_memory_ring_next = 0;
+static std::atomic<uint64_t> s_memory_ring_id = {0};
+
+MemoryRingLogAppender::MemoryRingLogAppender(const std::string& path, size_t capacity
+        , LogLevel::Level dump_level, bool raw)
+    : m_id(++s_memory_ring_id), m_path(path), m_capacity(std::max(capacity, (size_t)1024))
+    , m_dumpLevel(dump_level), m_raw(raw), m_rings(new std::atomic<Ring*>[kMaxThreads]) {
+    for (size_t i = 0; i < kMaxThreads; ++i) {
+        m_rings[i] = nullptr;
+    }
+    LogCrashHandler::AddAppender(this);
 }
 
-//====================== Implementation of LogAppender ======================
-FileLogAppender::FileLogAppender(const std::string& filename) : m_filename(filename){
-    m_filestream.open(m_filename, std::ios_base::out | std::ios_base::app);
+MemoryRingLogAppender::~MemoryRingLogAppender() {
+    LogCrashHandler::DelAppender(this);
+    for (size_t i = 0; i < m_ringCount; ++i) {
+        delete m_rings[i].load();
+    }
 }
 
-void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event){
-    if (level >= m_level){
+MemoryRingLogAppender::Ring* MemoryRingLogAppender::getRing() {
+    for (auto& cache : t_memory_ring_cache) {
+        if (cache.id == m_id) {
+            return cache.ring;
+        }
+    }
+    uint32_t thread_id = GetThreadId();
+    Ring* ring = nullptr;
+    {
         MutexType::Lock lock(m_mutex);
-        m_filestream << m_formatter->format(logger, level, event);
+        size_t count = m_ringCount;
+        for (size_t i = 0; i < count; ++i) {
+            if (m_rings[i].load()->thread_id == thread_id) {
+                ring = m_rings[i];
+                break;
+            }
+        }
+        if (!ring) {
+            if (count >= kMaxThreads) {
+                return nullptr;
+            }
+            ring = new Ring(m_capacity);
+            ring->thread_id = thread_id;
+            m_rings[count].store(ring, std::memory_order_release);
+            m_ringCount.store(count + 1, std::memory_order_release);
+        }
+        //线程id可能被新线程复用
+        strncpy(ring->thread_name, Thread::GetName().c_str(), sizeof(ring->thread_name) - 1);
     }
+    MemoryRingCache& cache = t_memory_ring_cache[t_memory_ring_next++ % 4];
+    cache.id = m_id;
+    cache.ring = ring;
+    return ring;
 }
 
-bool FileLogAppender::reopen(){
-    MutexType::Lock lock(m_mutex);
-    if(m_filestream){
-        m_filestream.close();
+void MemoryRingLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) {
+    if (!m_raw) {
+        formatAndLog(logger, level, event);
+        return;
+    }
+    if (level < m_level) {
+        return;
     }
+    append(level, *event, event->getContentData(), event->getContentSize());
+}
+
+void MemoryRingLogAppender::logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+        , const std::string& formatted) {
+    if (level >= m_level) {
+        append(level, *event, formatted.data(), formatted.size());
+    }
+}
 
-    m_filestream.open(m_filename);
-    return !!m_filestream;
+void MemoryRingLogAppender::append(LogLevel::Level level, const LogEvent& event, const char* data, size_t len) {
+    Ring* ring = getRing();
+    if (ring) {
+        //raw格式的前缀: [logger] file:line
+        char prefix[256];
+        size_t prefix_len = 0;
+        if (m_raw) {
+            auto put = [&prefix, &prefix_len](const char* str, size_t n) {
+                n = std::min(n, sizeof(prefix) - prefix_len);
+                memcpy(prefix + prefix_len, str, n);
+                prefix_len += n;
+            };
+            const std::string& name = event.getLogger()->getName();
+            char line[16];
+            int line_len = snprintf(line, sizeof(line), ":%d ", event.getLine());
+            put("[", 1);
+            put(name.data(), name.size());
+            put("] ", 2);
+            put(event.getFile(), strlen(event.getFile()));
+            put(line, line_len);
+        }
+        size_t max_len = m_capacity - kMemoryRecordHeader;
+        prefix_len = std::min(prefix_len, max_len);
+        len = std::min(len, max_len - prefix_len);
 
-}
+        char header[kMemoryRecordHeader];
+        uint32_t text_len = prefix_len + len;
+        uint64_t time_us = event.getTime() * 1000000 + event.getUsec();
+        memcpy(header, &text_len, sizeof(text_len));
+        memcpy(header + sizeof(text_len), &time_us, sizeof(time_us));
+        header[sizeof(text_len) + sizeof(time_us)] = (char)level;
+        size_t total = kMemoryRecordHeader + text_len;
 
-FileLogAppender::~FileLogAppender(){
-    if (m_filestream.is_open()){
-        m_filestream.close();
+        Spinlock::Lock lock(ring->mutex);
+        //覆盖最早的记录
+        while (ring->tail + total - ring->head > m_capacity) {
+            uint32_t old_len;
+            ring->get(ring->head, (char*)&old_len, sizeof(old_len));
+            ring->head += kMemoryRecordHeader + old_len;
+        }
+        ring->put(ring->tail, header, kMemoryRecordHeader);
+        ring->put(ring->tail + kMemoryRecordHeader, prefix, prefix_len);
+        ring->put(ring->tail + kMemoryRecordHeader + prefix_len, data, len);
+        ring->tail += total;
+    }
+    if (m_dumpLevel != LogLevel::UNKONWN && level >= m_dumpLevel) {
+        dump(LogLevel::ToString(level));
     }
 }
 
-std::string FileLogAppender::toYamlString() {
-    YAML::Node node;
-    node["type"] = "FileLogAppender";
-    if (m_level != LogLevel::UNKONWN){
-        node["level"] = LogLevel::ToString(m_level);
-    }
+void MemoryRingLogAppender::dump(const char* reason) {
+    Mutex::Lock lock(m_dumpMutex);
+    dumpRings(reason, false);
+}
 
-    if (m_formatter && m_hasFormatter){
-        node["format"] = m_formatter->getPattern();
-    }
-    node["path"] = m_filename;
-    std::stringstream ss;
-    ss << node;
-    return ss.str();
+void MemoryRingLogAppender::crashFlush() {
+    dumpRings("crash", true);
 }
 
-void StdoutLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event){
-    if (level >= m_level){
-        MutexType::Lock lock(m_mutex);
-        std::cout << m_formatter->format(logger, level, event);
+void MemoryRingLogAppender::dumpRings(const char* reason, bool crash) {
+    int fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    {
+        SignalSafeWriter out(fd);
+        out.append("==== memory log dump (").append(reason).append(") at ").time(GetCurrentUS()).append(" ====\n");
+        size_t count = m_ringCount.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i) {
+            Ring* ring = m_rings[i].load(std::memory_order_acquire);
+            if (crash) {
+                if (!CrashTryLock(ring->mutex)) {
+                    continue;
+                }
+            } else {
+                ring->mutex.lock();
+            }
+            if (ring->head != ring->tail) {
+                out.append("--- thread ").number(ring->thread_id).append(" ").append(ring->thread_name).append(" ---\n");
+            }
+            char buf[512];
+            for (uint64_t pos = ring->head; pos < ring->tail;) {
+                char header[kMemoryRecordHeader];
+                ring->get(pos, header, kMemoryRecordHeader);
+                uint32_t len;
+                uint64_t time_us;
+                memcpy(&len, header, sizeof(len));
+                memcpy(&time_us, header + sizeof(len), sizeof(time_us));
+                LogLevel::Level level = (LogLevel::Level)header[sizeof(len) + sizeof(time_us)];
+                if (m_raw) {
+                    out.time(time_us).append(" ").append(LogLevel::ToString(level)).append(" ");
+                }
+                pos += kMemoryRecordHeader;
+                for (uint32_t done = 0; done < len;) {
+                    size_t n = std::min((size_t)(len - done), sizeof(buf));
+                    ring->get(pos + done, buf, n);
+                    out.append(buf, n);
+                    done += n;
+                }
+                if (m_raw) {
+                    out.append("\n");
+                }
+                pos += len;
+            }
+            ring->head = ring->tail;
+            ring->mutex.unlock();
+        }
     }
+    ::close(fd);
 }
 
-std::string StdoutLogAppender::toYamlString() {
+std::string MemoryRingLogAppender::toYamlString() {
     MutexType::Lock lock(m_mutex);
     YAML::Node node;
-    node["type"] = "StdoutLogAppender";
+    node["type"] = "MemoryRingLogAppender";
     if (m_level != LogLevel::UNKONWN){
         node["level"] = LogLevel::ToString(m_level);
     }
     if (m_formatter && m_hasFormatter){
         node["format"] = m_formatter->getPattern();
     }
+    node["path"] = m_path;
+    node["capacity"] = m_capacity;
+    node["dump_level"] = LogLevel::ToString(m_dumpLevel);
+    node["raw"] = m_raw;
     std::stringstream ss;
     ss << node;
     return ss.str();
 }
 
-//====================== Implementation of Formatter ======================
-LogFormatter::LogFormatter(const std::string &pattern) : m_pattern(pattern){
-    init();
+//====================== Implementation of SocketLogAppender ======================
+
+SocketLogAppender::SocketLogAppender(const std::string& path, bool stream, bool syslog
+        , size_t max_bytes, uint32_t flush_interval, const std::string& app_name, int facility)
+    : m_path(path), m_stream(stream), m_syslog(syslog), m_maxBytes(max_bytes)
+    , m_flushInterval(flush_interval), m_appName(app_name), m_facility(facility) {
+    m_overload = LogOverload::DROP_NEWEST;
+    if (m_appName.empty()) {
+        m_appName = program_invocation_short_name;
+    }
+    char hostname[256] = {0};
+    if (gethostname(hostname, sizeof(hostname) - 1) != 0 || !hostname[0]) {
+        strcpy(hostname, "-");
+    }
+    m_syslogFields = std::string(" ") + hostname + " " + m_appName + " " + std::to_string(getpid()) + " ";
+    m_batch.reserve(kMaxBatch);
+    m_running = true;
+    m_thread.reset(new Thread(std::bind(&SocketLogAppender::run, this), "log_socket"));
+    LogCrashHandler::AddAppender(this);
 }
 
+SocketLogAppender::~SocketLogAppender() {
+    if (m_running.exchange(false)) {
+        LogCrashHandler::DelAppender(this);
+        m_semaphore.notify();
+        m_thread->join();
+        m_thread.reset();
+    }
+    closePeer();
+}
 
-//配置日志格式
-//%xxx %xxx{xxx} %%
-/*
- * %m 消息体
- * %p level
- * %r time elapse
- * %c log name
- * %t thread id
- * %n return/enter
- * %d time/date
- * %f file name
- * %l line #
- */
-void LogFormatter::init() {
-    //str, format, type
-    std::vector<std::tuple<std::string, std::string, int>> vec;
-    std::string n_str;
+void SocketLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) {
+    formatAndLog(logger, level, event);
+}
 
-    for (size_t i=0; i<m_pattern.size(); i++){
-        //如果是非%字符, 则直接
-        if (m_pattern[i] != '%'){
-            n_str.append(1, m_pattern[i]);
-            continue;
+void SocketLogAppender::logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+        , const std::string& msg) {
+    if (level < m_level) {
+        return;
+    }
+    std::string record;
+    if (m_syslog) {
+        //RFC5424的severity, 按LogLevel取值
+        static const int kSeverity[] = {7, 7, 6, 4, 3, 2};
+        int severity = level >= LogLevel::DEBUG && level <= LogLevel::FATAL ? kSeverity[level] : 7;
+        time_t time = event->getTime();
+        struct tm tm;
+        gmtime_r(&time, &tm);
+        char header[64];
+        int n = snprintf(header, sizeof(header), "<%d>1 %04d-%02d-%02dT%02d:%02d:%02d.%06uZ"
+                , m_facility * 8 + severity, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday
+                , tm.tm_hour, tm.tm_min, tm.tm_sec, (unsigned)event->getUsec());
+        //MSGID最长32个字符
+        const std::string& name = event->getLogger()->getName();
+        size_t len = msg.size();
+        if (len && msg[len - 1] == '\n') {
+            --len;
+        }
+        std::string body;
+        body.reserve(n + m_syslogFields.size() + 32 + 3 + len);
+        body.append(header, n).append(m_syslogFields);
+        if (name.empty()) {
+            body.append("-");
+        } else {
+            body.append(name, 0, 32);
+        }
+        body.append(" - ").append(msg, 0, len);
+        if (m_stream) {
+            record = std::to_string(body.size());
+            record.append(" ").append(body);
+        } else {
+            record = std::move(body);
         }
+    } else {
+        record = msg;
+    }
 
-        if ((i+1) < m_pattern.size()){
-            if (m_pattern[i + 1] == '%'){
-                n_str.append(1, m_pattern[i]);
+    bool need_notify = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        //后台线程正在发送的记录不能丢弃; 队列为空时总是接受, 避免超长的记录一直等待
+        while (m_queueBytes && m_queueBytes + record.size() > m_maxBytes && m_running) {
+            if (m_overload == LogOverload::DROP_OLDEST && !m_queue.empty()) {
+                m_queueBytes -= m_queue.front().size();
+                m_queue.pop_front();
+                m_metrics.onDrop();
+                continue;
+            }
+            if (!waitsOnOverload(level)) {
+                m_metrics.onDrop();
+                return;
             }
+            m_metrics.onBlock();
+            waitForSpace(lock);
         }
+        need_notify = m_queue.empty();
+        m_queueBytes += record.size();
+        m_metrics.onEnqueue(record.size(), m_queueBytes);
+        m_queue.push_back(std::move(record));
+    }
+    if (need_notify) {
+        m_semaphore.notify();
+    }
+}
 
-        size_t n = i+1;
-        //用于处理大括号中的内容
-        int fmt_status = 0;
-        size_t fmt_begin = 0;
+bool SocketLogAppender::connectPeer() {
+    uint64_t now = GetElapseMS();
+    if (m_lastConnect && now - m_lastConnect < m_flushInterval) {
+        return false;
+    }
+    m_lastConnect = now ? now : 1;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (m_path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memcpy(addr.sun_path, m_path.c_str(), m_path.size());
+    int fd = ::socket(AF_UNIX, (m_stream ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        ::close(fd);
+        return false;
+    }
+    m_fd = fd;
+    m_offset = 0;
+    return true;
+}
 
-        std::string str;
-        std::string fmt;
-        while (n < m_pattern.size()){
-            if (!fmt_status && (!isalpha(m_pattern[n]) && m_pattern[n] != '{' && m_pattern[n] != '}')){
-                str = m_pattern.substr(i+1, n-i-1);
-                break;
-            }
+void SocketLogAppender::closePeer() {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    //stream重连后从记录开头重发
+    m_offset = 0;
+}
 
-            if (fmt_status == 0){
-                if (m_pattern[n] == '{'){
-                    str = m_pattern.substr(i+1, n-i-1);
-                    fmt_status = 1;
-                    fmt_begin = n;
-                    ++n;
-                    continue;
-                }
+size_t SocketLogAppender::sendBatch() {
+    struct iovec iovs[kMaxBatch];
+    size_t count = m_batch.size() - m_next;
+    for (size_t i = 0; i < count; ++i) {
+        const std::string& record = m_batch[m_next + i];
+        iovs[i].iov_base = (void*)record.data();
+        iovs[i].iov_len = record.size();
+    }
+    iovs[0].iov_base = (char*)iovs[0].iov_base + m_offset;
+    iovs[0].iov_len -= m_offset;
 
-            }else if (fmt_status == 1){
-                if(m_pattern[n] == '}'){
-                    fmt = m_pattern.substr(fmt_begin+1, n-fmt_begin-1);
-                    fmt_status = 0;
-                    ++n;
-                    break;
-                }
-            }
-            ++n;
-            if (n == m_pattern.size()) {
-                if (str.empty()){
-                    str = m_pattern.substr(i+1);
+    if (m_stream) {
+        size_t done = 0;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iovs;
+        msg.msg_iovlen = count;
+        ssize_t n = ::sendmsg(m_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) {
+            //最后一条可能只发送了一部分
+            while (n > 0) {
+                size_t left = m_batch[m_next].size() - m_offset;
+                if ((size_t)n >= left) {
+                    n -= left;
+                    m_offset = 0;
+                    ++m_next;
+                    ++done;
+                } else {
+                    m_offset += n;
+                    n = 0;
                 }
             }
+            m_sent += done;
+            return done;
         }
-
-        if (fmt_status == 0){
-            if (!n_str.empty()){
-                vec.push_back(std::make_tuple(n_str, "", 0));
-                n_str.clear();
-            }
-            vec.push_back(std::make_tuple(str, fmt, 1));
-            i = n - 1;
-        } else if (fmt_status == 1){
-            std::cout << "pattern parse error: " << m_pattern << " - " << m_pattern.substr(i) << std::endl;
-            vec.push_back(std::make_tuple("<<pattern_error>>", fmt, 0));
-            m_error = true;
+    } else {
+        struct mmsghdr msgs[kMaxBatch];
+        memset(msgs, 0, sizeof(msgs[0]) * count);
+        for (size_t i = 0; i < count; ++i) {
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = ::sendmmsg(m_fd, msgs, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) {
+            m_next += n;
+            m_sent += n;
+            return n;
+        }
+        if (errno == EMSGSIZE) {
+            ++m_next;
+            m_metrics.onDrop();
+            return 1;
         }
     }
 
-    if (!n_str.empty()){
-        vec.push_back(std::make_tuple(n_str, "", 0));
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS || errno == EINTR) {
+        struct pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        ::poll(&pfd, 1, m_flushInterval);
+    } else {
+        closePeer();
     }
+    return 0;
+}
 
-    static std::map<std::string, std::function<LogFormatter::FormatItem::pointer (const std::string& str)>> formatItems = {
-#define XX(str, C) {#str, [](const std::string& fmt) -> LogFormatter::FormatItem::pointer { return LogFormatter::FormatItem::pointer(new C(fmt));}}
-
-    XX(m, MessageFormatItem), //m:消息
-    XX(p, LevelFormatItem),   //p:日志级别
-    XX(r, ElapseFormatItem),  //r:累计毫秒数
-    XX(c, NameFormatItem),    //c:日志名称
-    XX(t, ThreadIdFormatItem),//t:线程id
-    XX(n, NewLineFormatItem), //n:换行
-    XX(d, DateTimeFormatItem),//d:时间
-    XX(f, FilenameFormatItem),//f:文件名
-    XX(l, LineFormatItem),    //l:行号
-    XX(T, TabFormatItem),     //T:Tab
-    XX(F, FiberFormatItem),   //F:协程id
-    XX(N, ThreadNameFormatItem) //N:线程名称
-#undef XX
-    };
+void SocketLogAppender::run() {
+    while (true) {
+        bool running = m_running;
+        if (m_next == m_batch.size()) {
+            bool empty;
+            {
+                MutexType::Lock lock(m_mutex);
+                m_batch.clear();
+                m_next = 0;
+                m_offset = 0;
+                empty = m_queue.empty();
+            }
+            if (empty) {
+                if (!running) {
+                    break;
+                }
+                m_semaphore.waitFor(m_flushInterval);
+            }
+            MutexType::Lock lock(m_mutex);
+            while (!m_queue.empty() && m_batch.size() < kMaxBatch) {
+                m_batch.push_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+            }
+        }
+        if (m_next == m_batch.size()) {
+            continue;
+        }
 
-    for(auto& i : vec){
-        if (std::get<2>(i) == 0){
-            m_items.push_back(LogFormatter::FormatItem::pointer(new StringFormatItem(std::get<0>(i))));
-        } else {
-            auto it = formatItems.find(std::get<0>(i));
-            if (it == formatItems.end()){
-                m_items.push_back(LogFormatter::FormatItem::pointer(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
-                m_error = true;
-            } else {
-                m_items.push_back(it->second(std::get<1>(i)));
+        size_t begin = m_next;
+        size_t offset = m_offset;
+        size_t done = 0;
+        if (m_fd >= 0 || connectPeer()) {
+            uint64_t start = GetCurrentUS();
+            done = sendBatch();
+            if (done > 0) {
+                m_metrics.onFlush(GetCurrentUS() - start);
             }
         }
-        //for tests: display parse result
-        //std::cout << '(' << std::get<0>(i) << ") - (" << std::get<1>(i) << ") - (" << std::get<2>(i) << ')' << std::endl;
+        if (done > 0) {
+            size_t bytes = 0;
+            for (size_t i = begin; i < begin + done; ++i) {
+                bytes += m_batch[i].size();
+            }
+            MutexType::Lock lock(m_mutex);
+            m_queueBytes -= bytes;
+            notifySpace();
+        } else if (m_fd >= 0 && m_offset != offset) {
+            continue;
+        } else if (!running) {
+            //结束时对端不可用或没有进展, 放弃剩下的记录
+            break;
+        } else if (m_fd < 0) {
+            m_semaphore.waitFor(m_flushInterval);
+        }
     }
-
+    //结束后不再等待空间
+    MutexType::Lock lock(m_mutex);
+    notifySpace();
 }
 
-std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) {
-    std::stringstream stringstream;
-    for (auto& item : m_items){
-        item->format(stringstream, logger, level, event);
+//可能与后台线程重复发送; stream正在发送半条记录时不发送, 避免破坏分帧
+void SocketLogAppender::crashFlush() {
+    int fd = m_fd;
+    if (fd < 0 || m_offset != 0 || !CrashTryLock(m_mutex)) {
+        return;
     }
-
-    return stringstream.str();
+    for (size_t i = m_next; i < m_batch.size(); ++i) {
+        if (::send(fd, m_batch[i].data(), m_batch[i].size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            m_mutex.unlock();
+            return;
+        }
+    }
+    for (auto& record : m_queue) {
+        if (::send(fd, record.data(), record.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            break;
+        }
+    }
+    m_mutex.unlock();
 }
 
-//====================== Implementation of LoggerManager ======================
-
-LoggerManager::LoggerManager(){
-    m_root.reset(new Logger());
-    m_root->addAppender(LogAppender::pointer(new StdoutLogAppender()));
-
-    m_loggers[m_root->getName()] = m_root;
-    init();
-}
-Logger::pointer LoggerManager::getLogger(const std::string& name){
+std::string SocketLogAppender::toYamlString() {
     MutexType::Lock lock(m_mutex);
-    auto it = m_loggers.find(name);
-    if (it != m_loggers.end()){
-        return it->second;
+    YAML::Node node;
+    node["type"] = "SocketLogAppender";
+    if (m_level != LogLevel::UNKONWN){
+        node["level"] = LogLevel::ToString(m_level);
     }
-    Logger::pointer new_logger(new Logger(name));
-    new_logger->m_root = m_root;
-    m_loggers[name] = new_logger;
-    return new_logger;
+    if (m_formatter && m_hasFormatter){
+        node["format"] = m_formatter->getPattern();
+    }
+    node["path"] = m_path;
+    node["stream"] = m_stream;
+    node["syslog"] = m_syslog;
+    node["buffer_size"] = m_maxBytes;
+    node["overload"] = LogOverload::ToString(m_overload);
+    node["overload_level"] = LogLevel::ToString(m_overloadLevel);
+    node["flush_interval"] = m_flushInterval;
+    node["app_name"] = m_appName;
+    node["facility"] = m_facility;
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
 }
 
 //偏特化模版类别
@@ -580,10 +3809,103 @@ public:
                 if (appender["type"].as<std::string>() == "FileLogAppender") {
                     log_appender.type = 1;
                     log_appender.file = appender["path"].as<std::string>();
+                    if (appender["async"].IsDefined()) {
+                        log_appender.async = appender["async"].as<bool>();
+                    }
+                    if (appender["buffer_size"].IsDefined()) {
+                        log_appender.buffer_size = appender["buffer_size"].as<uint32_t>();
+                    }
+                    if (appender["flush_interval"].IsDefined()) {
+                        log_appender.flush_interval = appender["flush_interval"].as<uint32_t>();
+                    }
 
+                } else if (appender["type"].as<std::string>() == "RollingFileLogAppender") {
+                    log_appender.type = 4;
+                    log_appender.file = appender["path"].as<std::string>();
+                    if (appender["max_size"].IsDefined()) {
+                        log_appender.max_size = appender["max_size"].as<uint64_t>();
+                    }
+                    if (appender["rotate_interval"].IsDefined()) {
+                        log_appender.rotate_interval = appender["rotate_interval"].as<uint32_t>();
+                    }
+                    if (appender["max_files"].IsDefined()) {
+                        log_appender.max_files = appender["max_files"].as<uint32_t>();
+                    }
+                } else if (appender["type"].as<std::string>() == "MmapLogAppender") {
+                    log_appender.type = 5;
+                    log_appender.file = appender["path"].as<std::string>();
+                    if (appender["chunk_size"].IsDefined()) {
+                        log_appender.chunk_size = appender["chunk_size"].as<uint32_t>();
+                    }
+                } else if (appender["type"].as<std::string>() == "GzipLogAppender") {
+                    log_appender.type = 6;
+                    log_appender.file = appender["path"].as<std::string>();
+                    if (appender["compress_level"].IsDefined()) {
+                        log_appender.compress_level = appender["compress_level"].as<int>();
+                    }
+                    if (appender["buffer_size"].IsDefined()) {
+                        log_appender.buffer_size = appender["buffer_size"].as<uint32_t>();
+                    }
+                    if (appender["flush_interval"].IsDefined()) {
+                        log_appender.flush_interval = appender["flush_interval"].as<uint32_t>();
+                    }
+                } else if (appender["type"].as<std::string>() == "MemoryRingLogAppender") {
+                    log_appender.type = 7;
+                    log_appender.file = appender["path"].as<std::string>();
+                    if (appender["capacity"].IsDefined()) {
+                        log_appender.capacity = appender["capacity"].as<uint32_t>();
+                    }
+                    if (appender["dump_level"].IsDefined()) {
+                        log_appender.dump_level = LogLevel::FromString(appender["dump_level"].as<std::string>());
+                    }
+                    if (appender["raw"].IsDefined()) {
+                        log_appender.raw = appender["raw"].as<bool>();
+                    }
+                } else if (appender["type"].as<std::string>() == "SocketLogAppender") {
+                    log_appender.type = 8;
+                    log_appender.file = appender["path"].as<std::string>();
+                    if (appender["stream"].IsDefined()) {
+                        log_appender.stream = appender["stream"].as<bool>();
+                    }
+                    if (appender["syslog"].IsDefined()) {
+                        log_appender.syslog = appender["syslog"].as<bool>();
+                    }
+                    if (appender["buffer_size"].IsDefined()) {
+                        log_appender.buffer_size = appender["buffer_size"].as<uint32_t>();
+                    }
+                    if (appender["flush_interval"].IsDefined()) {
+                        log_appender.flush_interval = appender["flush_interval"].as<uint32_t>();
+                    }
+                    if (appender["app_name"].IsDefined()) {
+                        log_appender.app_name = appender["app_name"].as<std::string>();
+                    }
+                    if (appender["facility"].IsDefined()) {
+                        log_appender.facility = appender["facility"].as<int>();
+                    }
+                } else if (appender["type"].as<std::string>() == "BinaryLogAppender") {
+                    log_appender.type = 3;
+                    log_appender.file = appender["path"].as<std::string>();
                 } else {
                     log_appender.type = 2;
                 }
+                if (appender["overload"].IsDefined()) {
+                    log_appender.overload = appender["overload"].as<std::string>();
+                }
+                if (appender["overload_level"].IsDefined()) {
+                    log_appender.overload_level = LogLevel::FromString(appender["overload_level"].as<std::string>());
+                }
+                if (appender["max_buffers"].IsDefined()) {
+                    log_appender.max_buffers = appender["max_buffers"].as<uint32_t>();
+                }
+                if (appender["batch_bytes"].IsDefined()) {
+                    log_appender.batch_bytes = appender["batch_bytes"].as<uint32_t>();
+                }
+                if (appender["batch_records"].IsDefined()) {
+                    log_appender.batch_records = appender["batch_records"].as<uint32_t>();
+                }
+                if (appender["batch_delay"].IsDefined()) {
+                    log_appender.batch_delay = appender["batch_delay"].as<uint32_t>();
+                }
                 log_define.appenders.push_back(log_appender);
             }
         }
@@ -611,8 +3933,63 @@ public:
             if (appender.type == 1){
                 node_appender["type"] = "FileLogAppender";
                 node_appender["file"] = appender.file;
+                if (appender.async) {
+                    node_appender["async"] = true;
+                    node_appender["buffer_size"] = appender.buffer_size;
+                    node_appender["flush_interval"] = appender.flush_interval;
+                }
             } else if (appender.type == 2){
                 node_appender["type"] = "StdoutLogAppender";
+            } else if (appender.type == 3){
+                node_appender["type"] = "BinaryLogAppender";
+                node_appender["path"] = appender.file;
+            } else if (appender.type == 4){
+                node_appender["type"] = "RollingFileLogAppender";
+                node_appender["path"] = appender.file;
+                node_appender["max_size"] = appender.max_size;
+                node_appender["rotate_interval"] = appender.rotate_interval;
+                node_appender["max_files"] = appender.max_files;
+            } else if (appender.type == 5){
+                node_appender["type"] = "MmapLogAppender";
+                node_appender["path"] = appender.file;
+                node_appender["chunk_size"] = appender.chunk_size;
+            } else if (appender.type == 6){
+                node_appender["type"] = "GzipLogAppender";
+                node_appender["path"] = appender.file;
+                node_appender["compress_level"] = appender.compress_level;
+                node_appender["buffer_size"] = appender.buffer_size;
+                node_appender["flush_interval"] = appender.flush_interval;
+            } else if (appender.type == 7){
+                node_appender["type"] = "MemoryRingLogAppender";
+                node_appender["path"] = appender.file;
+                node_appender["capacity"] = appender.capacity;
+                node_appender["dump_level"] = LogLevel::ToString(appender.dump_level);
+                node_appender["raw"] = appender.raw;
+            } else if (appender.type == 8){
+                node_appender["type"] = "SocketLogAppender";
+                node_appender["path"] = appender.file;
+                node_appender["stream"] = appender.stream;
+                node_appender["syslog"] = appender.syslog;
+                node_appender["buffer_size"] = appender.buffer_size;
+                node_appender["flush_interval"] = appender.flush_interval;
+                if (!appender.app_name.empty()) {
+                    node_appender["app_name"] = appender.app_name;
+                }
+                node_appender["facility"] = appender.facility;
+            }
+
+            if ((appender.type == 1 && appender.async) || appender.type == 6) {
+                node_appender["max_buffers"] = appender.max_buffers;
+            }
+            if (!appender.overload.empty()) {
+                node_appender["overload"] = appender.overload;
+                node_appender["overload_level"] = LogLevel::ToString(appender.overload_level);
+            }
+
+            if ((appender.type == 1 || appender.type == 2) && appender.batch_bytes) {
+                node_appender["batch_bytes"] = appender.batch_bytes;
+                node_appender["batch_records"] = appender.batch_records;
+                node_appender["batch_delay"] = appender.batch_delay;
             }
 
             if (appender.level != LogLevel::UNKONWN){
@@ -628,6 +4005,11 @@ public:
 
 ConfigVar<std::set<LogDefine>>::pointer g_log_defines = Config::Lookup("logs", std::set<LogDefine>(), "logs config");
 
+static ConfigVar<bool>::pointer g_log_pipeline_enable =
+        Config::Lookup("log.pipeline.enable", false, "log events through per-thread queues and a collector thread");
+static ConfigVar<uint32_t>::pointer g_log_pipeline_ring_size =
+        Config::Lookup<uint32_t>("log.pipeline.ring_size", 8192, "per-thread log queue capacity");
+
 struct LogIniter {
     LogIniter() {
         g_log_defines->addListener(
@@ -641,10 +4023,11 @@ struct LogIniter {
                     //add new logger
                     new_logger = LOG_NAME(i.name);
                 } else { //modified
-                    if (!(i == *it)){
-                        //先找到需要修改的logger
-                        new_logger = LOG_NAME(i.name);
+                    if (i == *it){
+                        continue;
                     }
+                    //先找到需要修改的logger
+                    new_logger = LOG_NAME(i.name);
                 }
                 new_logger->setLevel(i.level);
                 if (! i.format.empty()){
@@ -655,9 +4038,39 @@ struct LogIniter {
                 for(auto& appender: i.appenders){
                     LogAppender::pointer new_appender;
                     if (appender.type == 1) { //file
-                        new_appender = std::make_shared<FileLogAppender>(appender.file);
+                        if (appender.async) {
+                            AsyncFileLogAppender::pointer async_appender = std::make_shared<AsyncFileLogAppender>(
+                                    appender.file, appender.buffer_size, appender.flush_interval);
+                            async_appender->setMaxBuffers(appender.max_buffers);
+                            new_appender = async_appender;
+                        } else {
+                            FileLogAppender::pointer file_appender = std::make_shared<FileLogAppender>(appender.file);
+                            file_appender->setBatch(appender.batch_bytes, appender.batch_records, appender.batch_delay);
+                            new_appender = file_appender;
+                        }
                     } else if (appender.type == 2) { //stdout
-                        new_appender = std::make_shared<StdoutLogAppender>();
+                        StdoutLogAppender::pointer stdout_appender = std::make_shared<StdoutLogAppender>();
+                        stdout_appender->setBatch(appender.batch_bytes, appender.batch_records, appender.batch_delay);
+                        new_appender = stdout_appender;
+                    } else if (appender.type == 3) { //binary
+                        new_appender = std::make_shared<BinaryLogAppender>(appender.file);
+                    } else if (appender.type == 4) { //rolling file
+                        new_appender = std::make_shared<RollingFileLogAppender>(appender.file
+                                , appender.max_size, appender.rotate_interval, appender.max_files);
+                    } else if (appender.type == 5) { //mmap
+                        new_appender = std::make_shared<MmapLogAppender>(appender.file, appender.chunk_size);
+                    } else if (appender.type == 6) { //gzip
+                        GzipLogAppender::pointer gzip_appender = std::make_shared<GzipLogAppender>(appender.file
+                                , appender.compress_level, appender.buffer_size, appender.flush_interval);
+                        gzip_appender->setMaxBuffers(appender.max_buffers);
+                        new_appender = gzip_appender;
+                    } else if (appender.type == 7) { //memory ring
+                        new_appender = std::make_shared<MemoryRingLogAppender>(appender.file, appender.capacity
+                                , appender.dump_level, appender.raw);
+                    } else if (appender.type == 8) { //socket
+                        new_appender = std::make_shared<SocketLogAppender>(appender.file, appender.stream
+                                , appender.syslog, appender.buffer_size, appender.flush_interval
+                                , appender.app_name, appender.facility);
                     }
 
                     if (!appender.format.empty()){
@@ -669,6 +4082,9 @@ struct LogIniter {
                                       << appender.format << std::endl;
                         }
                     }
+                    if (!appender.overload.empty()) {
+                        new_appender->setOverload(LogOverload::FromString(appender.overload), appender.overload_level);
+                    }
                     new_appender->setLevel(appender.level);
                     new_logger->addAppender(new_appender);
                 }
@@ -679,9 +4095,9 @@ struct LogIniter {
                 auto it = new_value.find(i);
                 if (it == new_value.end()){
                     //for deletion
-                    //这里并不是真的需要删除，而是把它level设置成非常高的值，让其无法输出信息
+                    //日志器不会真的删除, 清除级别和appender后重新继承上级的配置
                     auto logger = LOG_NAME(i.name);
-                    logger->setLevel((LogLevel::Level)100);
+                    logger->setLevel(LogLevel::UNKONWN);
                     logger->clearAppender();
                 }
             }
@@ -691,6 +4107,89 @@ struct LogIniter {
 
 static LogIniter __log_init;
 
+struct LogPipelineIniter {
+    LogPipelineIniter() {
+        g_log_pipeline_enable->addListener([](const bool& old_value, const bool& new_value){
+            if (new_value) {
+                LogPipelineMgr::GetInstance()->start(g_log_pipeline_ring_size->getValue());
+            } else {
+                LogPipelineMgr::GetInstance()->stop();
+            }
+        });
+    }
+};
+
+static LogPipelineIniter __log_pipeline_init;
+
+static ConfigVar<bool>::pointer g_log_fiber_offload =
+        Config::Lookup("log.fiber.offload", false, "hand log events from fibers to the pipeline collector thread");
+
+struct LogFiberOffloadIniter {
+    LogFiberOffloadIniter() {
+        g_log_fiber_offload->addListener([](const bool& old_value, const bool& new_value){
+            LogPipeline::SetFiberOffload(new_value);
+        });
+    }
+};
+
+static LogFiberOffloadIniter __log_fiber_offload_init;
+
+static ConfigVar<std::vector<std::string> >::pointer g_log_dynamic_debug =
+        Config::Lookup("log.dynamic_debug", std::vector<std::string>()
+                , "turn individual log statements on(+) or off(-): file:<glob>[:line], func:<glob>, logger:<glob>");
+
+struct LogDynamicDebugIniter {
+    LogDynamicDebugIniter() {
+        g_log_dynamic_debug->addListener([](const std::vector<std::string>& old_value
+                , const std::vector<std::string>& new_value){
+            LogSite::SetDynamicRules(new_value);
+        });
+    }
+};
+
+static LogDynamicDebugIniter __log_dynamic_debug_init;
+
+static ConfigVar<uint32_t>::pointer g_log_summary_interval =
+        Config::Lookup<uint32_t>("log.rate_limit.summary_interval", 10000
+                , "interval(ms) of the suppressed-message summary of rate limited log sites, 0 to disable");
+
+struct LogLimiterIniter {
+    LogLimiterIniter() {
+        g_log_summary_interval->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            LogLimiter::SetSummaryInterval(new_value);
+        });
+    }
+};
+
+static LogLimiterIniter __log_limiter_init;
+
+static ConfigVar<bool>::pointer g_log_crash_enable =
+        Config::Lookup("log.crash.enable", false
+                , "on SIGSEGV/SIGABRT/..., flush buffered appenders and dump recent log events and a backtrace");
+static ConfigVar<uint32_t>::pointer g_log_crash_ring_size =
+        Config::Lookup<uint32_t>("log.crash.ring_size", 32, "recent log events kept per thread for the crash dump");
+static ConfigVar<std::string>::pointer g_log_crash_path =
+        Config::Lookup<std::string>("log.crash.path", "", "file the crash dump is appended to, stderr if empty");
+
+struct LogCrashIniter {
+    LogCrashIniter() {
+        g_log_crash_enable->addListener([](const bool& old_value, const bool& new_value){
+            if (new_value) {
+                LogCrashHandler::Install(g_log_crash_ring_size->getValue(), g_log_crash_path->getValue());
+            } else {
+                LogCrashHandler::Uninstall();
+            }
+        });
+        g_log_crash_path->addListener([](const std::string& old_value, const std::string& new_value){
+            if (g_log_crash_enable->getValue()) {
+                LogCrashHandler::Install(g_log_crash_ring_size->getValue(), new_value);
+            }
+        });
+    }
+};
+
+static LogCrashIniter __log_crash_init;
+
 void LoggerManager::init(){
 
 }
\ No newline at end of file
@@ -19,10 +19,45 @@
 #include <fstream>
 #include <vector>
 #include <map>
+#include <atomic>
+#include <cstdarg>
+#include <cstring>
+#include <type_traits>
+#include <deque>
+
+//编译期最低级别: 低于该级别的日志语句在编译时整条去掉, 例如 -DWEBFRAMEWORK_MIN_LOG_LEVEL=2 去掉所有DEBUG日志
+#ifndef WEBFRAMEWORK_MIN_LOG_LEVEL
+#define WEBFRAMEWORK_MIN_LOG_LEVEL 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define WEBFRAMEWORK_LIKELY(x) __builtin_expect(!!(x), 1)
+#define WEBFRAMEWORK_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define WEBFRAMEWORK_LIKELY(x) (x)
+#define WEBFRAMEWORK_UNLIKELY(x) (x)
+#endif
+
+//调用点的静态描述, 常量初始化, 不需要运行时构造
+#define LOG_SITE() \
+    []() -> LogSite* { \
+        static LogSite s_log_site(__FILE__, __LINE__); \
+        return &s_log_site; \
+    }()
+
+//用for代替if, 避免宏后面的else和宏内部的if配对; 循环体只执行一次
+//低于WEBFRAMEWORK_MIN_LOG_LEVEL时log_site初始化为常量nullptr, 整条语句在编译期被去掉
+//cond在级别检查通过后才求值, 可以使用log_site
+#define LOG_SITE_BEGIN_IF(logger, level, cond) \
+    for (LogSite* log_site = ((int)(level) >= WEBFRAMEWORK_MIN_LOG_LEVEL) ? LOG_SITE() : nullptr; \
+            WEBFRAMEWORK_UNLIKELY(log_site && log_site->isEnabled(logger->getEffectiveLevel(), level, __func__) && (cond)); \
+            log_site = nullptr) \
+        LogEventWrap(LogEvent::Acquire(log_site, logger, level, GetElapseMS(), GetThreadId(), GetFiberId(), GetCurrentUS(), Thread::GetName()))
+
+#define LOG_SITE_BEGIN(logger, level) LOG_SITE_BEGIN_IF(logger, level, true)
 
 #define LOG_LEVEL(logger, level) \
-    if (logger->getLevel() <= level) \
-        LogEventWrap(LogEvent::pointer(new LogEvent(logger, level, __FILE__, __LINE__, 0, GetThreadId(), GetFiberId(), time(0), Thread::GetName()))).getStringstream()
+    LOG_SITE_BEGIN(logger, level).getStringstream()
 
 #define LOG_DEBUG(logger) LOG_LEVEL(logger, LogLevel::DEBUG)
 #define LOG_INFO(logger) LOG_LEVEL(logger, LogLevel::INFO)
@@ -30,9 +65,16 @@
 #define LOG_ERROR(logger) LOG_LEVEL(logger, LogLevel::ERROR)
 #define LOG_FATAL(logger) LOG_LEVEL(logger, LogLevel::FATAL)
 
+//fmt是字符串字面量时编译期检查fmt与参数的类型和个数(见logarg::CheckFormat), 不匹配时编译失败;
+//其他fmt(const char*变量, std::string等)跳过检查, 参数在调用时立即格式化(见logarg::RuntimeFormat)
+#define LOG_FMT_TRAITS(fmt, ...) logarg::FormatOf<decltype(logarg::TypesOf(__VA_ARGS__)), decltype(fmt)>
+#define LOG_FMT_CHECK(fmt, ...) \
+    LOG_FMT_TRAITS(fmt, __VA_ARGS__)::Checked<(LOG_FMT_TRAITS(fmt, __VA_ARGS__)::kLiteral \
+            ? LOG_FMT_TRAITS(fmt, __VA_ARGS__)::Check(fmt) : true)>(fmt)
+
+//参数按类型编码后保存在事件中, 需要文本时才格式化
 #define LOG_FMR_LEVEL(logger, level, fmt, ...) \
-    if (logger->getLevel() <= level) \
-        LogEventWrap(LogEvent::pointer(new LogEvent(logger, level, __FILE__, __LINE__, 0, GetThreadId(), GetFiberId(), time(0), Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+    LOG_SITE_BEGIN(logger, level).getEvent()->formatArgs(LOG_FMT_CHECK(fmt, __VA_ARGS__), __VA_ARGS__)
 
 #define LOG_FMT_DEBUT(logger, fmt, ...)  LOG_FMR_LEVEL(logger, LogLevel::DEBUG, fmt, __VA_ARGS__)
 #define LOG_FMT_INFO(logger, fmt, ...)  LOG_FMR_LEVEL(logger, LogLevel::INFO, fmt, __VA_ARGS__)
@@ -40,11 +82,41 @@
 #define LOG_FMT_ERROR(logger, fmt, ...)  LOG_FMR_LEVEL(logger, LogLevel::ERROR, fmt, __VA_ARGS__)
 #define LOG_FMT_FATAL(logger, fmt, ...)  LOG_FMR_LEVEL(logger, LogLevel::FATAL, fmt, __VA_ARGS__)
 
+//限流和采样: 每个调用点一个常量初始化的LogLimiter, 被抑制时不构造LogEvent
+//被抑制的次数累计起来, 每隔log.rate_limit.summary_interval毫秒在该调用点输出一条汇总
+#define LOG_LIMITER() \
+    []() -> LogLimiter* { \
+        static LogLimiter s_log_limiter; \
+        return &s_log_limiter; \
+    }()
+
+#define LOG_LIMITED(logger, level, method, arg) \
+    LOG_SITE_BEGIN_IF(logger, level, LOG_LIMITER()->method(arg, log_site, logger, level))
+
+//每n次输出1次(第1, n+1, 2n+1...次)
+#define LOG_EVERY_N(logger, level, n) LOG_LIMITED(logger, level, everyN, n).getStringstream()
+//只输出前n次
+#define LOG_FIRST_N(logger, level, n) LOG_LIMITED(logger, level, firstN, n).getStringstream()
+//每ms毫秒最多输出1次
+#define LOG_EVERY_MS(logger, level, ms) LOG_LIMITED(logger, level, everyMs, ms).getStringstream()
+//按概率rate(0~1)随机输出
+#define LOG_SAMPLED(logger, level, rate) LOG_LIMITED(logger, level, sample, rate).getStringstream()
+
+#define LOG_FMT_EVERY_N(logger, level, n, fmt, ...) \
+    LOG_LIMITED(logger, level, everyN, n).getEvent()->formatArgs(LOG_FMT_CHECK(fmt, __VA_ARGS__), __VA_ARGS__)
+#define LOG_FMT_FIRST_N(logger, level, n, fmt, ...) \
+    LOG_LIMITED(logger, level, firstN, n).getEvent()->formatArgs(LOG_FMT_CHECK(fmt, __VA_ARGS__), __VA_ARGS__)
+#define LOG_FMT_EVERY_MS(logger, level, ms, fmt, ...) \
+    LOG_LIMITED(logger, level, everyMs, ms).getEvent()->formatArgs(LOG_FMT_CHECK(fmt, __VA_ARGS__), __VA_ARGS__)
+#define LOG_FMT_SAMPLED(logger, level, rate, fmt, ...) \
+    LOG_LIMITED(logger, level, sample, rate).getEvent()->formatArgs(LOG_FMT_CHECK(fmt, __VA_ARGS__), __VA_ARGS__)
+
 #define LOG_ROOT() LoggerMgr::GetInstance()->getRoot()
 #define LOG_NAME(name) LoggerMgr::GetInstance()->getLogger(name)
 
 class Logger;
 class LoggerManager;
+struct z_stream_s;
 //====================== Defination of LogLevel ======================
 class LogLevel {
 public:
@@ -57,6 +129,443 @@ public:
 };
 
 
+//====================== Defination of LogStreamBuf ======================
+//日志消息缓冲区: 先写入对象内的定长数组, 超长时才转到堆上
+//堆上的空间在reset后保留, 同一对象再遇到超长消息时无需重新分配
+class LogStreamBuf : public std::streambuf {
+public:
+    static const size_t kInlineSize = 512;
+
+    LogStreamBuf();
+
+    const char* data() const {
+        return pbase();
+    }
+
+    size_t size() const {
+        return pptr() - pbase();
+    }
+
+    void reset();
+
+    void append(const char* str, size_t len) {
+        if (WEBFRAMEWORK_UNLIKELY(len > (size_t)(epptr() - pptr()))) {
+            reserve(len);
+        }
+        memcpy(pptr(), str, len);
+        pbump((int)len);
+    }
+
+    void vprintf(const char* fmt, va_list va);
+protected:
+    virtual int_type overflow(int_type ch) override;
+    virtual std::streamsize xsputn(const char* str, std::streamsize len) override;
+private:
+    void reserve(size_t len);
+private:
+    char m_inline[kInlineSize];
+    std::vector<char> m_heap;
+};
+
+//====================== Defination of LogSite ======================
+//日志调用点的静态信息, 每个LOG_*宏展开处有一个常量初始化的静态对象
+//第一次执行时注册(分配id, 记录函数名和级别, 应用动态调试规则), 之后每次只读取一次state
+//
+//动态调试(log.dynamic_debug): 运行时按规则打开/关闭单个调用点, 规则按顺序匹配, 后面的覆盖前面的
+//  [+|-]file:<glob>[:line]  按文件(完整路径或文件名)和行号
+//  [+|-]func:<glob>         按函数名
+//  [+|-]logger:<glob>       按logger名称, 匹配的logger输出所有级别
+//  +(默认)表示无论logger级别都输出, -表示关闭
+struct LogSite {
+    enum State : uint8_t {
+        UNREGISTERED = 0,
+        ENABLED = 1,  //按logger的级别过滤
+        DISABLED = 2, //关闭这个调用点
+        FORCED = 3    //忽略logger的级别
+    };
+
+    constexpr LogSite(const char* file_, int32_t line_) : file(file_), line(line_) {
+    }
+
+    bool isEnabled(LogLevel::Level logger_level, LogLevel::Level site_level, const char* site_func) {
+        if (WEBFRAMEWORK_LIKELY(state.load(std::memory_order_relaxed) == ENABLED)) {
+            return logger_level <= site_level;
+        }
+        return checkSlow(logger_level, site_level, site_func);
+    }
+
+    void setEnabled(bool v);
+
+    bool isForced() const {
+        return state.load(std::memory_order_relaxed) == FORCED;
+    }
+
+    //所有已注册的调用点, 按id排列
+    static std::vector<LogSite*> GetSites();
+
+    //替换动态调试规则, 立即作用于已注册的调用点和已有的logger
+    static void SetDynamicRules(const std::vector<std::string>& rules);
+    //logger名称是否被logger:规则选中
+    static bool MatchLogger(const std::string& name);
+
+    std::atomic<uint32_t> id = {0}; //注册时分配, 从1开始
+    const char* const file;
+    const int32_t line;
+    const char* func = nullptr;
+    LogLevel::Level level = LogLevel::UNKONWN;
+    std::atomic<uint8_t> state = {UNREGISTERED};
+private:
+    bool checkSlow(LogLevel::Level logger_level, LogLevel::Level site_level, const char* site_func);
+    LogSite(const LogSite&) = delete;
+    LogSite& operator=(const LogSite&) = delete;
+};
+
+//====================== Defination of LogField ======================
+//附加在日志上的键值对, 用法: LOG_INFO(logger) << LogField("user", id) << "message"
+//JSON格式输出为独立的字段, 其他格式不输出; 不是日志事件的流中写成key=value
+//字符串值只在当前语句内引用, 不复制
+struct LogField {
+    enum Type : uint8_t {
+        STRING, INT, UINT, DOUBLE, BOOL
+    };
+
+    LogField(const char* k, const char* v) : key(k), type(STRING), str(v ? v : "null"), len(v ? strlen(v) : 4) {
+    }
+
+    LogField(const char* k, const std::string& v) : key(k), type(STRING), str(v.c_str()), len(v.size()) {
+    }
+
+    LogField(const char* k, bool v) : key(k), type(BOOL), i(v) {
+    }
+
+    template<class T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+    LogField(const char* k, T v) : key(k), type(INT), i(v) {
+    }
+
+    template<class T, typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, int>::type = 0>
+    LogField(const char* k, T v) : key(k), type(UINT), u(v) {
+    }
+
+    template<class T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+    LogField(const char* k, T v) : key(k), type(DOUBLE), d(v) {
+    }
+
+    const char* key;
+    Type type;
+    union {
+        const char* str;
+        int64_t i;
+        uint64_t u;
+        double d;
+    };
+    size_t len = 0;
+};
+
+std::ostream& operator<<(std::ostream& os, const LogField& field);
+
+//====================== Defination of LogLimiter ======================
+//单个调用点的限流状态, 所有计数都是原子操作, 多线程共享
+class LogLimiter {
+public:
+    constexpr LogLimiter() {
+    }
+
+    bool everyN(uint64_t n, const LogSite* site, const std::shared_ptr<Logger>& logger, LogLevel::Level level) {
+        if (n <= 1 || m_count.fetch_add(1, std::memory_order_relaxed) % n == 0) {
+            return true;
+        }
+        return suppress(site, logger, level, 0);
+    }
+
+    bool firstN(uint64_t n, const LogSite* site, const std::shared_ptr<Logger>& logger, LogLevel::Level level) {
+        //超过n之后不再写计数器, 避免多线程反复修改同一缓存行
+        if (m_count.load(std::memory_order_relaxed) < n
+                && m_count.fetch_add(1, std::memory_order_relaxed) < n) {
+            return true;
+        }
+        return suppress(site, logger, level, 0);
+    }
+
+    bool everyMs(uint64_t ms, const LogSite* site, const std::shared_ptr<Logger>& logger, LogLevel::Level level) {
+        uint64_t now = GetCurrentMS();
+        uint64_t last = m_last.load(std::memory_order_relaxed);
+        if ((last == 0 || now - last >= ms)
+                && m_last.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+            return true;
+        }
+        return suppress(site, logger, level, now);
+    }
+
+    bool sample(double rate, const LogSite* site, const std::shared_ptr<Logger>& logger, LogLevel::Level level) {
+        if (rate >= 1 || (rate > 0 && Random() < (uint32_t)(rate * 4294967295.0))) {
+            return true;
+        }
+        return suppress(site, logger, level, 0);
+    }
+
+    //汇总输出的间隔(ms), 0表示不输出汇总
+    static void SetSummaryInterval(uint32_t ms);
+private:
+    //记录一次抑制, 到了汇总时间时输出被抑制的条数; 总是返回false
+    bool suppress(const LogSite* site, const std::shared_ptr<Logger>& logger, LogLevel::Level level, uint64_t now);
+    //线程局部的xorshift随机数
+    static uint32_t Random();
+private:
+    std::atomic<uint64_t> m_count = {0};
+    std::atomic<uint64_t> m_last = {0};        //everyMs上次输出的时间
+    std::atomic<uint64_t> m_suppressed = {0};
+    std::atomic<uint64_t> m_lastSummary = {0}; //上次汇总的时间
+};
+
+//LOG_FMT_*参数的编码: 1字节类型 + 本机字节序的值, 字符串为4字节长度 + 内容
+//先用Size算出总长度, 缓冲区只扩展一次, 再用Write依次写入
+namespace logarg {
+
+enum Tag : char {
+    INT = 'i',
+    UINT = 'u',
+    DOUBLE = 'd',
+    STRING = 's',
+    POINTER = 'p'
+};
+
+inline char* Put(char* out, char tag, const void* data, size_t len) {
+    *out++ = tag;
+    memcpy(out, data, len);
+    return out + len;
+}
+
+template<class T>
+typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value, size_t>::type
+Size(T val) {
+    return 1 + 8;
+}
+
+inline size_t Size(const char* str) {
+    return 1 + sizeof(uint32_t) + (str ? strlen(str) : 6);
+}
+
+inline size_t Size(char* str) {
+    return Size((const char*)str);
+}
+
+inline size_t Size(const std::string& str) {
+    return 1 + sizeof(uint32_t) + str.size();
+}
+
+template<class T>
+size_t Size(const T* ptr) {
+    return 1 + 8;
+}
+
+template<class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, char*>::type
+Write(char* out, T val) {
+    int64_t v = val;
+    return Put(out, INT, &v, sizeof(v));
+}
+
+template<class T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, char*>::type
+Write(char* out, T val) {
+    uint64_t v = val;
+    return Put(out, UINT, &v, sizeof(v));
+}
+
+template<class T>
+typename std::enable_if<std::is_enum<T>::value, char*>::type
+Write(char* out, T val) {
+    int64_t v = (int64_t)val;
+    return Put(out, INT, &v, sizeof(v));
+}
+
+template<class T>
+typename std::enable_if<std::is_floating_point<T>::value, char*>::type
+Write(char* out, T val) {
+    double v = val;
+    return Put(out, DOUBLE, &v, sizeof(v));
+}
+
+inline char* WriteString(char* out, const char* str, size_t len) {
+    uint32_t l = len;
+    out = Put(out, STRING, &l, sizeof(l));
+    memcpy(out, str, len);
+    return out + len;
+}
+
+inline char* Write(char* out, const char* str) {
+    if (!str) {
+        str = "(null)";
+    }
+    return WriteString(out, str, strlen(str));
+}
+
+inline char* Write(char* out, char* str) {
+    return Write(out, (const char*)str);
+}
+
+inline char* Write(char* out, const std::string& str) {
+    return WriteString(out, str.c_str(), str.size());
+}
+
+template<class T>
+char* Write(char* out, const T* ptr) {
+    uint64_t v = (uintptr_t)ptr;
+    return Put(out, POINTER, &v, sizeof(v));
+}
+
+//按fmt(printf格式)把编码后的参数格式化输出到buf
+void Render(LogStreamBuf& buf, const char* fmt, const char* data, size_t len);
+
+//编译期检查格式与参数类型, 见LOG_FMT_CHECK:
+//  d i u o x X c 对应整数(包括bool/char/枚举), e E f F g G a A 对应浮点数,
+//  s 对应字符串(const char*/std::string), p 对应指针或字符串, *宽度/*精度 对应整数, 参数个数必须相同
+template<class... T>
+struct TypeList {};
+
+//只在decltype中使用, 不需要定义
+template<class... Args>
+TypeList<typename std::decay<Args>::type...> TypesOf(const Args&... args);
+
+template<class T>
+constexpr char Kind() {
+    return std::is_same<T, std::string>::value || std::is_same<T, const char*>::value
+                   || std::is_same<T, char*>::value ? 's'
+           : std::is_integral<T>::value || std::is_enum<T>::value ? 'i'
+           : std::is_floating_point<T>::value ? 'f'
+           : std::is_pointer<T>::value ? 'p' : '?';
+}
+
+template<class List>
+struct Kinds;
+
+template<class... T>
+struct Kinds<TypeList<T...>> {
+    static constexpr char value[sizeof...(T) + 1] = {Kind<T>()..., 0};
+};
+
+template<class... T>
+constexpr char Kinds<TypeList<T...>>::value[sizeof...(T) + 1];
+
+constexpr bool Accept(char conv, char kind) {
+    return conv == 'd' || conv == 'i' || conv == 'u' || conv == 'o' || conv == 'x' || conv == 'X'
+                   || conv == 'c' ? kind == 'i'
+           : conv == 'e' || conv == 'E' || conv == 'f' || conv == 'F' || conv == 'g' || conv == 'G'
+                   || conv == 'a' || conv == 'A' ? kind == 'f'
+           : conv == 's' ? kind == 's'
+           : conv == 'p' ? kind == 'p' || kind == 's'
+           : false;
+}
+
+constexpr size_t SkipFlags(const char* s, size_t p) {
+    return s[p] == '-' || s[p] == '+' || s[p] == ' ' || s[p] == '#' || s[p] == '0' || s[p] == '\''
+           ? SkipFlags(s, p + 1) : p;
+}
+
+constexpr size_t SkipDigits(const char* s, size_t p) {
+    return s[p] >= '0' && s[p] <= '9' ? SkipDigits(s, p + 1) : p;
+}
+
+constexpr size_t SkipLength(const char* s, size_t p) {
+    return s[p] == 'h' || s[p] == 'l' || s[p] == 'j' || s[p] == 'z' || s[p] == 't' || s[p] == 'L' || s[p] == 'q'
+           ? SkipLength(s, p + 1) : p;
+}
+
+//[begin, end)中第一个'%'的位置, 没有时返回end; 二分查找使递归深度为log(n), 长字符串也不会超过编译器的限制
+constexpr size_t FindPercent(const char* s, size_t begin, size_t end);
+
+constexpr size_t FindPercentRight(const char* s, size_t found, size_t mid, size_t end) {
+    return found != mid ? found : FindPercent(s, mid, end);
+}
+
+constexpr size_t FindPercent(const char* s, size_t begin, size_t end) {
+    return end - begin == 0 ? end
+           : end - begin == 1 ? (s[begin] == '%' ? begin : end)
+           : FindPercentRight(s, FindPercent(s, begin, (begin + end) / 2), (begin + end) / 2, end);
+}
+
+//k为剩余参数的类型, 以0结尾
+constexpr bool CheckFrom(const char* s, size_t pos, size_t len, const char* k);
+
+constexpr bool CheckConv(const char* s, size_t q, size_t len, const char* k) {
+    return *k != 0 && Accept(s[q], *k) && CheckFrom(s, q + 1, len, k + 1);
+}
+
+constexpr bool CheckPrecision(const char* s, size_t q, size_t len, const char* k) {
+    return s[q] != '.' ? CheckConv(s, SkipLength(s, q), len, k)
+           : s[q + 1] == '*' ? *k == 'i' && CheckConv(s, SkipLength(s, q + 2), len, k + 1)
+           : CheckConv(s, SkipLength(s, SkipDigits(s, q + 1)), len, k);
+}
+
+constexpr bool CheckWidth(const char* s, size_t q, size_t len, const char* k) {
+    return s[q] == '*' ? *k == 'i' && CheckPrecision(s, q + 1, len, k + 1)
+           : CheckPrecision(s, SkipDigits(s, q), len, k);
+}
+
+constexpr bool CheckAt(const char* s, size_t pct, size_t len, const char* k) {
+    return pct >= len ? *k == 0
+           : s[pct + 1] == '%' ? CheckFrom(s, pct + 2, len, k)
+           : CheckWidth(s, SkipFlags(s, pct + 1), len, k);
+}
+
+constexpr bool CheckFrom(const char* s, size_t pos, size_t len, const char* k) {
+    return CheckAt(s, FindPercent(s, pos, len), len, k);
+}
+
+template<class List, size_t N>
+constexpr bool CheckFormat(const char (&fmt)[N]) {
+    return CheckFrom(fmt, 0, N - 1, Kinds<List>::value);
+}
+
+template<bool Valid>
+inline const char* CheckedFormat(const char* fmt) {
+    static_assert(Valid, "LOG_FMT_*: format string does not match the argument types");
+    return fmt;
+}
+
+//不是字面量的fmt: 生命周期不确定, 不能像字面量一样只保存指针, 由LogEvent::formatArgs立即格式化
+struct RuntimeFormat {
+    const char* fmt;
+};
+
+template<class List, class Fmt>
+struct FormatTraits {
+    static constexpr bool kLiteral = false;
+
+    static constexpr bool Check(const Fmt&) {
+        return true;
+    }
+
+    template<bool Valid>
+    static RuntimeFormat Checked(const char* fmt) {
+        return RuntimeFormat{fmt};
+    }
+
+    template<bool Valid>
+    static RuntimeFormat Checked(const std::string& fmt) {
+        return RuntimeFormat{fmt.c_str()};
+    }
+};
+
+template<class List, size_t N>
+struct FormatTraits<List, const char[N]> {
+    static constexpr bool kLiteral = true;
+
+    static constexpr bool Check(const char (&fmt)[N]) {
+        return CheckFormat<List>(fmt);
+    }
+
+    template<bool Valid>
+    static const char* Checked(const char* fmt) {
+        return CheckedFormat<Valid>(fmt);
+    }
+};
+
+template<class List, class Fmt>
+using FormatOf = FormatTraits<List, typename std::remove_reference<Fmt>::type>;
+
+}
+
 //====================== Defination of LogEvent::LogEvent ======================
 class LogEvent {
 public:
@@ -64,10 +573,30 @@ public:
     LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
             , const char* file, int32_t line
             , uint32_t elapse, uint32_t threadid
-            , uint32_t fiberid, uint32_t time
+            , uint32_t fiberid, uint64_t time_us
             , const std::string& thread_name);
     ~LogEvent();
 
+    //从线程局部的事件池中取出一个空闲事件并重新初始化, 池中没有空闲事件时才分配新对象
+    //事件空闲的条件是只被池本身引用(use_count() == 1)
+    static LogEvent::pointer Acquire(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+            , const char* file, int32_t line
+            , uint32_t elapse, uint32_t threadid
+            , uint32_t fiberid, uint64_t time_us
+            , const std::string& thread_name);
+
+    //LOG_*宏使用, 文件名和行号取自调用点
+    static LogEvent::pointer Acquire(const LogSite* site, const std::shared_ptr<Logger>& logger, LogLevel::Level level
+            , uint32_t elapse, uint32_t threadid
+            , uint32_t fiberid, uint64_t time_us
+            , const std::string& thread_name);
+
+    void reset(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+            , const char* file, int32_t line
+            , uint32_t elapse, uint32_t threadid
+            , uint32_t fiberid, uint64_t time_us
+            , const std::string& thread_name);
+
     const char* getFile() const {
         return m_file;
     }
@@ -88,23 +617,63 @@ public:
         return m_fiberid;
     }
 
-    uint32_t getTime() const {
+    //秒级时间戳
+    uint64_t getTime() const {
         return m_time;
     }
 
+    //秒以下的微秒部分
+    uint32_t getUsec() const {
+        return m_usec;
+    }
+
     const std::string getContent() const {
-        return m_sstream.str();
+        return std::string(getContentData(), getContentSize());
+    }
+
+    const char* getContentData() const {
+        renderArgs();
+        return m_buf.data();
+    }
+
+    size_t getContentSize() const {
+        renderArgs();
+        return m_buf.size();
+    }
+
+    //LOG_*宏的调用点, 其他方式产生的事件为nullptr
+    const LogSite* getSite() const {
+        return m_site;
+    }
+
+    //LOG_FMT_*的格式和编码后的参数, 其他事件的格式为nullptr
+    const char* getFmt() const {
+        return m_fmt;
+    }
+
+    const std::string& getArgs() const {
+        return m_args;
     }
 
     const std::string& getThreadName() const {
         return m_thread_name;
     }
 
-    std::stringstream& getStringStream() {
-        return m_sstream;
+    std::ostream& getStringStream() {
+        return m_stream;
     }
 
-    std::shared_ptr<Logger> getLogger() const {
+    //LogField编码成的JSON片段, 每个字段为 ,"key":value
+    const std::string& getFields() const {
+        return m_fields;
+    }
+
+    void addField(const LogField& field);
+
+    //事件的流在pword(StreamIndex())中保存事件指针, 供LogField找到所属的事件
+    static int StreamIndex();
+
+    const std::shared_ptr<Logger>& getLogger() const {
         return m_logger;
     }
 
@@ -114,6 +683,45 @@ public:
 
     void format(const char* fmt, ...);
     void format(const char* fmt, va_list va);
+
+    //只记录调用点和按类型编码的参数, 消息在第一次读取内容时才格式化
+    template<class... Args>
+    void formatArgs(const char* fmt, const Args&... args) {
+        m_fmt = fmt;
+        appendArgs(args...);
+        m_argsPending = true;
+    }
+
+    //fmt不是字面量, 调用返回后可能失效: 编码后立即格式化, 不保存fmt
+    template<class... Args>
+    void formatArgs(const logarg::RuntimeFormat& fmt, const Args&... args) {
+        size_t pos = m_args.size();
+        appendArgs(args...);
+        logarg::Render(m_buf, fmt.fmt, m_args.data() + pos, m_args.size() - pos);
+        m_args.resize(pos);
+    }
+
+    //用已编码的参数设置内容, 用于从二进制日志还原事件
+    void setArgs(const char* fmt, const char* data, size_t len);
+private:
+    template<class... Args>
+    void appendArgs(const Args&... args) {
+        size_t pos = m_args.size();
+        size_t size = pos;
+        int sizes[] = {0, (size += logarg::Size(args), 0)...};
+        (void)sizes;
+        m_args.resize(size);
+        char* out = &m_args[pos];
+        int expand[] = {0, (out = logarg::Write(out, args), 0)...};
+        (void)expand;
+    }
+
+    void renderArgs() const {
+        if (m_argsPending) {
+            m_argsPending = false;
+            logarg::Render(m_buf, m_fmt, m_args.data(), m_args.size());
+        }
+    }
 private:
     const char* m_file = nullptr;
     int32_t m_line = 0; // 行号
@@ -123,7 +731,14 @@ private:
     //协程id
     uint32_t m_fiberid = 0;
     uint64_t m_time;
-    std::stringstream m_sstream;
+    uint32_t m_usec = 0;
+    mutable LogStreamBuf m_buf;
+    std::ostream m_stream;
+    const LogSite* m_site = nullptr;
+    const char* m_fmt = nullptr;
+    std::string m_args;
+    mutable bool m_argsPending = false;
+    std::string m_fields;
 
     std::shared_ptr<Logger> m_logger;
     LogLevel::Level m_level;
@@ -134,11 +749,11 @@ public:
     explicit LogEventWrap(LogEvent::pointer event);
     ~LogEventWrap();
 
-    LogEvent::pointer getEvent() const {
+    const LogEvent::pointer& getEvent() const {
         return m_event;
     }
 
-    std::stringstream& getStringstream() {
+    std::ostream& getStringstream() {
         return m_event->getStringStream();
     }
 
@@ -150,21 +765,80 @@ private:
 class LogFormatter {
 public:
     using pointer = std::shared_ptr<LogFormatter>;
+    //编译期已知格式的输出函数, 见LogFormatter::Create
+    using StaticFormat = void (*)(std::string& buf, LogLevel::Level level, const LogEvent& event);
+
+    //JSON中time字段的默认格式, 可以用%J{...}指定
+    static const char* const kJsonDateFormat;
 
+    //pattern为"json"时等同于"%J%n"
     LogFormatter(const std::string& pattern);
 
+    //由编译期已知的格式项直接生成格式化函数, 例如
+    //LogFormatter::Create<logfmt::DateTime<>, logfmt::Tab, logfmt::Message, logfmt::NewLine>()
+    template<class... Items>
+    static LogFormatter::pointer Create();
+
     //%t    %thread_id %m%n
     std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event);
+    //追加到调用者提供的缓冲区, 缓冲区可以在多次调用间复用
+    void format(std::string& buf, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::pointer& event);
 
 public:
-    class FormatItem {
-    public:
-        using pointer = std::shared_ptr<FormatItem>;
-        explicit FormatItem(const std::string& fmt = "") {};
-        virtual ~FormatItem() = default;
-        virtual void format(std::ostream& stream, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) = 0;
+    //pattern在init中编译成的指令
+    enum Op : uint8_t {
+        STRING,     //普通字符串
+        MESSAGE,    //m:消息
+        LEVEL,      //p:日志级别
+        ELAPSE,     //r:累计毫秒数
+        NAME,       //c:日志名称
+        THREAD_ID,  //t:线程id
+        NEWLINE,    //n:换行
+        DATETIME,   //d:时间
+        FILENAME,   //f:文件名
+        LINE,       //l:行号
+        TAB,        //T:Tab
+        FIBER_ID,   //F:协程id
+        THREAD_NAME,//N:线程名称
+        JSON        //J:整条事件输出为一个JSON对象
     };
 
+    //%d{...}的格式, 末尾的%ms/%us会被去掉, 改为追加3/6位的毫秒/微秒
+    //strftime的结果按秒缓存在线程局部变量中, 同一秒内不再重复调用localtime_r/strftime
+    struct DateTimeFormat {
+        explicit DateTimeFormat(const std::string& format);
+
+        std::string format; //交给strftime的部分
+        uint32_t id;        //线程局部缓存的key, 每个DateTimeFormat唯一
+        int digits;         //0, 3(%ms), 6(%us)
+    };
+
+    struct Item {
+        Op op;
+        std::string str; //STRING的内容
+        std::shared_ptr<DateTimeFormat> date;
+    };
+
+    //以下函数输出单个格式项, 编译后的指令和编译期格式共用
+    //%T之后的下一项需要右对齐补齐到5个字符, width记录待补齐的宽度, 输出后清零
+    static void Append(std::string& buf, size_t& width, const char* str, size_t len);
+    static void AppendNumber(std::string& buf, size_t& width, int64_t val);
+    static void AppendDateTime(std::string& buf, size_t& width, const DateTimeFormat& fmt, uint64_t time, uint32_t usec);
+    //带引号的JSON字符串, 转义直接写入buf
+    static void AppendJsonString(std::string& buf, const char* str, size_t len);
+    //{"time":...,"level":...,"logger":...,"thread_id":...,"thread_name":...,"fiber_id":...,"elapse":...,
+    // "file":...,"line":...,"message":...,字段...}
+    static void AppendJson(std::string& buf, size_t& width, const DateTimeFormat& date, LogLevel::Level level, const LogEvent& event);
+
+    static void AppendTab(std::string& buf, size_t& width) {
+        Append(buf, width, "\t", 1);
+        width = 5;
+    }
+
+    static void AppendNewLine(std::string& buf, size_t& width) {
+        buf.push_back('\n');
+    }
+
     void init();
 
     bool isError() const {
@@ -175,13 +849,82 @@ public:
         return m_pattern;
     }
 private:
-    std::vector<FormatItem::pointer> m_items;
+    std::vector<Item> m_items;
     std::string m_pattern;
     bool m_error = false;
+    StaticFormat m_static = nullptr;
 };
 
 //=============================================================
 
+//有缓冲的appender(AsyncLogAppender及其子类, SocketLogAppender)在缓冲区满时的处理方式
+//  BLOCK: 等待后台线程写出腾出空间
+//  DROP_NEWEST: 丢弃当前记录
+//  DROP_OLDEST: 丢弃最早的还没交给后台线程的记录, 没有可丢弃的时丢弃当前记录
+//  DROP_BELOW_LEVEL: 低于指定级别的记录丢弃, 其余的等待
+struct LogOverload {
+    enum Policy {
+        BLOCK = 0,
+        DROP_NEWEST = 1,
+        DROP_OLDEST = 2,
+        DROP_BELOW_LEVEL = 3
+    };
+
+    //block/drop_newest/drop_oldest/drop_below_level, 无法识别时返回BLOCK
+    static Policy FromString(const std::string& str);
+    static const char* ToString(Policy policy);
+};
+
+//appender的缓冲统计, 计数只增加; 没有缓冲的appender全部为0
+class LogAppenderMetrics {
+public:
+    //写出延迟按2的幂分桶(微秒): 第0个桶为<1us, 第i个桶为[2^(i-1), 2^i), 最后一个桶包括更大的值
+    static const size_t kLatencyBuckets = 24;
+
+    struct Snapshot {
+        uint64_t enqueued = 0;   //进入缓冲区的记录数
+        uint64_t dropped = 0;    //因过载丢弃的记录数
+        uint64_t bytes = 0;      //进入缓冲区的字节数
+        uint64_t max_depth = 0;  //缓冲区中还没写出的最大字节数
+        uint64_t blocked = 0;    //因缓冲区满等待的次数
+        uint64_t flushes = 0;    //后台线程批量写出的次数
+        uint64_t flush_latency[kLatencyBuckets] = {0};
+
+        //第p(0~1)分位的写出延迟所在桶的上界(微秒), 没有写出时返回0
+        uint64_t flushLatencyPercentile(double p) const;
+    };
+
+    void onEnqueue(size_t bytes, size_t depth) {
+        m_enqueued.fetch_add(1, std::memory_order_relaxed);
+        m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        uint64_t max = m_maxDepth.load(std::memory_order_relaxed);
+        while (depth > max && !m_maxDepth.compare_exchange_weak(max, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    void onDrop(uint64_t count = 1) {
+        m_dropped.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void onBlock() {
+        m_blocked.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    LogAppenderMetrics();
+
+    void onFlush(uint64_t us);
+
+    Snapshot snapshot() const;
+private:
+    std::atomic<uint64_t> m_enqueued = {0};
+    std::atomic<uint64_t> m_dropped = {0};
+    std::atomic<uint64_t> m_bytes = {0};
+    std::atomic<uint64_t> m_maxDepth = {0};
+    std::atomic<uint64_t> m_blocked = {0};
+    std::atomic<uint64_t> m_flushes = {0};
+    std::atomic<uint64_t> m_flushLatency[kLatencyBuckets];
+};
+
 //日志输出路径
 class LogAppender {
 public:
@@ -193,6 +936,18 @@ public:
     virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) = 0;
     virtual std::string toYamlString() = 0;
 
+    //输出已经用getFormatter()格式化好的内容, Logger对使用同一个formatter的appender只格式化一次
+    //不输出格式化文本的appender不需要重写, 默认忽略formatted直接调用log
+    virtual void logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+            , const std::string& formatted) {
+        log(logger, level, event);
+    }
+
+    //是否输出formatter格式化的文本
+    virtual bool usesFormatter() const {
+        return false;
+    }
+
     void setLevel(LogLevel::Level level){
         m_level = level;
     }
@@ -230,23 +985,74 @@ public:
         return m_hasFormatter;
     }
 
+    //进程崩溃时由信号处理函数调用, 写出还在缓冲区中的内容, 见LogCrashHandler
+    //只能使用write(2)等async-signal-safe的调用, 不能分配内存, 也不能等待锁
+    virtual void crashFlush() {}
+
+    //缓冲区最多容纳的字节数, 0表示没有缓冲或不限制
+    virtual size_t getCapacity() const {
+        return 0;
+    }
+
+    //缓冲区满时的处理方式, 只对有缓冲的appender有效; level为DROP_BELOW_LEVEL时不丢弃的最低级别
+    void setOverload(LogOverload::Policy policy, LogLevel::Level level = LogLevel::WARN) {
+        m_overload = policy;
+        m_overloadLevel = level;
+    }
+
+    LogOverload::Policy getOverload() const {
+        return m_overload;
+    }
+
+    LogLevel::Level getOverloadLevel() const {
+        return m_overloadLevel;
+    }
+
+    LogAppenderMetrics::Snapshot getMetrics() const {
+        return m_metrics.snapshot();
+    }
+
 protected:
-    LogLevel::Level m_level;
+    //格式化到线程局部缓冲区后调用logFormatted, 供输出文本的appender实现log
+    void formatAndLog(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event);
+
+    //缓冲区满时当前记录是否等待空间, 否则丢弃
+    bool waitsOnOverload(LogLevel::Level level) const {
+        return m_overload == LogOverload::BLOCK
+               || (m_overload == LogOverload::DROP_BELOW_LEVEL && level >= m_overloadLevel);
+    }
+    //释放lock(持有m_mutex)等待notifySpace, 返回时重新持有
+    void waitForSpace(MutexType::Lock& lock);
+    //后台线程腾出空间后调用, 调用时持有m_mutex
+    void notifySpace();
+protected:
+    LogLevel::Level m_level = LogLevel::UNKONWN; //UNKONWN表示不按级别过滤
     bool m_hasFormatter = false;
     MutexType m_mutex;
     LogFormatter::pointer m_formatter;
+    LogOverload::Policy m_overload = LogOverload::BLOCK;
+    LogLevel::Level m_overloadLevel = LogLevel::WARN;
+    LogAppenderMetrics m_metrics;
+private:
+    Semaphore m_space;
+    uint32_t m_spaceWaiters = 0;
 };
 
 
 //日志器 -> 定义日志类别
+//由LoggerManager创建的日志器按名字中的'.'组成树, "http.server.conn"的父节点为"http.server", 最上层为root
+//没有设置级别(UNKONWN)时继承父节点的级别, 没有appender时使用最近的有appender的祖先的appender
+//级别和appender在修改时沿子树向下解析并缓存, 输出时不需要查找祖先
 class Logger : public std::enable_shared_from_this<Logger> {
     friend class LoggerManager;
 
 public:
     using pointer = std::shared_ptr<Logger>;
     using MutexType = Spinlock;
+    using AppenderList = std::vector<LogAppender::pointer>;
 
     explicit Logger(const std::string& name = "root");
+    ~Logger();
     void log(LogLevel::Level level, LogEvent::pointer event);
 
     void debug(LogEvent::pointer event);
@@ -259,18 +1065,37 @@ public:
     void delAppender(LogAppender::pointer appender);
     void clearAppender();
 
+    //自己的appender, 不包括继承的
+    std::shared_ptr<const AppenderList> getAppenders() const {
+        return std::atomic_load(&m_appenders);
+    }
+
+    //自己设置的级别, UNKONWN表示继承父节点
     LogLevel::Level getLevel(){
         return m_level;
     }
 
-    void setLevel(LogLevel::Level level){
-        m_level = level;
+    void setLevel(LogLevel::Level level);
+
+    //实际用于过滤的级别: 继承后的级别, 被动态调试规则选中时为DEBUG
+    LogLevel::Level getEffectiveLevel() const {
+        return m_effectiveLevel.load(std::memory_order_relaxed);
+    }
+
+    void setDebugForced(bool v);
+
+    bool isDebugForced() const {
+        return m_debugForced.load(std::memory_order_relaxed);
     }
 
     const std::string& getName() const {
         return m_name;
     }
 
+    Logger::pointer getParent() const {
+        return m_parent;
+    }
+
     void setFormatter(LogFormatter::pointer val);
     void setFormatter(const std::string& val);
 
@@ -280,44 +1105,547 @@ public:
     }
 
     std::string toYamlString();
+private:
+    //解析后实际输出到的appender, owner为appender所属的日志器(自己或祖先)
+    struct Output {
+        std::shared_ptr<const AppenderList> appenders;
+        Logger* owner = nullptr;
+    };
+
+    //多个appender时每个不同的formatter只格式化一次, 结果交给所有使用它的appender
+    void logFanOut(const Logger::pointer& self, const AppenderList& appenders, LogLevel::Level level
+            , const LogEvent::pointer& event);
+
+    //重新解析自己和整个子树的级别与appender
+    void resolve();
+    //调用者持有TreeMutex()
+    void resolveLocked();
+
+    //保护所有日志器的父子关系和解析结果
+    static MutexType& TreeMutex();
 private:
     std::string m_name;
     LogLevel::Level m_level = LogLevel::DEBUG; //满足日志级别的才可输出
-    std::list<LogAppender::pointer> m_appenders; //Appender列表
+    LogLevel::Level m_resolvedLevel = LogLevel::DEBUG; //继承后的级别, 子节点从这里继承
+    std::atomic<LogLevel::Level> m_effectiveLevel;
+    std::atomic<bool> m_debugForced = {false};
+    //Appender列表, 修改时复制一份新的再原子替换, 输出时只取快照不加锁
+    std::shared_ptr<const AppenderList> m_appenders;
+    std::shared_ptr<const Output> m_output;
     LogFormatter::pointer m_formatter;
 
-    //当Logger没有Appender时，调用root Logger的log
-    Logger::pointer m_root;
+    //父节点和子节点由LoggerManager设置, 独立创建的日志器没有父节点
+    Logger::pointer m_parent;
+    std::vector<Logger*> m_children;
 
     MutexType m_mutex;
 };
 
-class StdoutLogAppender : public LogAppender{
+//可选的批量输出: 开启后记录先追加到缓冲区, 满足任一条件时用一次write写出
+//  累计字节数达到max_bytes, 条数达到max_records, 最早的记录超过max_delay毫秒(由LogFlusher线程检查), 或遇到FATAL
+//未开启时每条记录单独写出
+class BatchLogAppender : public LogAppender {
 public:
-    using pointer = std::shared_ptr<StdoutLogAppender>;
+    using pointer = std::shared_ptr<BatchLogAppender>;
+    virtual ~BatchLogAppender() override;
     virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override;
+    virtual void logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+            , const std::string& formatted) override;
+    virtual bool usesFormatter() const override {
+        return true;
+    }
+
+    //max_bytes为0时关闭批量输出
+    void setBatch(size_t max_bytes, uint32_t max_records = 0, uint32_t max_delay = 100);
+
+    bool isBatching() const {
+        return m_maxBytes > 0;
+    }
+
+    size_t getBatchBytes() const {
+        return m_maxBytes;
+    }
+
+    uint32_t getBatchRecords() const {
+        return m_maxRecords;
+    }
+
+    uint32_t getBatchDelay() const {
+        return m_maxDelay;
+    }
+
+    //写出缓冲的记录
+    void flush();
+    //最早的记录已超过max_delay时写出, 返回距离下次需要检查的毫秒数
+    uint32_t flushExpired(uint64_t now_ms);
+    virtual void crashFlush() override;
+protected:
+    //子类析构时必须先调用, 写出剩余记录并停止定时检查
+    void stopBatch();
+    //写出一条或一批记录, 调用时持有m_mutex
+    virtual void write(const char* data, size_t len) = 0;
+    //崩溃时写出缓冲区, 只能使用write(2)
+    virtual void crashWrite(const char* data, size_t len) = 0;
+    //yaml中追加批量输出的配置
+    void batchToYaml(YAML::Node& node) const;
+private:
+    void flushLocked();
+private:
+    size_t m_maxBytes = 0;
+    uint32_t m_maxRecords = 0;
+    uint32_t m_maxDelay = 0;  //ms
+    std::string m_batch;
+    uint32_t m_records = 0;
+    uint64_t m_firstTime = 0; //缓冲区中最早记录的时间
+};
+
+//定时写出批量输出中超时的记录, 所有BatchLogAppender共用一个线程
+class LogFlusher {
+public:
+    using MutexType = Mutex;
+    LogFlusher();
+
+    void add(BatchLogAppender* appender);
+    void del(BatchLogAppender* appender);
+private:
+    void run();
+private:
+    MutexType m_mutex;
+    std::vector<BatchLogAppender*> m_appenders;
+    Thread::pointer m_thread;
+    Semaphore m_semaphore;
+};
+
+//进程退出时不析构, 避免在appender之前被销毁
+LogFlusher* GetLogFlusher();
+
+class StdoutLogAppender : public BatchLogAppender{
+public:
+    using pointer = std::shared_ptr<StdoutLogAppender>;
+    virtual ~StdoutLogAppender() override;
     virtual std::string toYamlString() override;
+protected:
+    virtual void write(const char* data, size_t len) override;
+    virtual void crashWrite(const char* data, size_t len) override;
 };
 
-class FileLogAppender : public LogAppender{
+class FileLogAppender : public BatchLogAppender{
 public:
     using pointer = std::shared_ptr<FileLogAppender>;
     explicit FileLogAppender(const std::string& filename);
     virtual ~FileLogAppender() override;
-    virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override ;
     virtual std::string toYamlString() override;
 
     bool reopen();
+protected:
+    virtual void write(const char* data, size_t len) override;
+    virtual void crashWrite(const char* data, size_t len) override;
+private:
+    std::string m_filename;
+    int m_fd = -1;
+};
+
+//异步输出: 调用线程只把格式化后的内容追加到前台缓冲区
+//后台线程定期(或缓冲区写满时)交换缓冲区, 批量写出
+class AsyncLogAppender : public LogAppender {
+public:
+    using pointer = std::shared_ptr<AsyncLogAppender>;
+    AsyncLogAppender(size_t buffer_size, uint32_t flush_interval);
+    virtual ~AsyncLogAppender() override;
+    virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override;
+    virtual void logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+            , const std::string& formatted) override;
+    virtual bool usesFormatter() const override {
+        return true;
+    }
+
+    size_t getBufferSize() const {
+        return m_bufferSize;
+    }
+
+    uint32_t getFlushInterval() const {
+        return m_flushInterval;
+    }
+
+    //最多缓冲的块数(每块buffer_size字节, 包括后台线程正在写出的), 超过时按过载策略处理; 0表示不限制
+    void setMaxBuffers(size_t max_buffers) {
+        m_maxBuffers = max_buffers;
+    }
+
+    size_t getMaxBuffers() const {
+        return m_maxBuffers;
+    }
+
+    virtual size_t getCapacity() const override {
+        return m_bufferSize * m_maxBuffers;
+    }
+
+    //写出所有缓冲内容并结束后台线程, 子类析构时必须调用
+    void stop();
+    virtual void crashFlush() override;
+protected:
+    //由子类在构造完成后调用
+    void start();
+    //以下两个函数只在后台线程中调用
+    virtual void writeBuffer(const char* data, size_t len) = 0;
+    virtual void flushOutput() {}
+    //崩溃时写出还没交给后台线程的缓冲区, 只能使用write(2); 默认丢弃
+    virtual void crashWrite(const char* data, size_t len) {}
+private:
+    void run();
+    //以下两个函数调用时持有m_mutex
+    //把前台缓冲区交给后台线程, 换一块空的
+    void rotateCurrent();
+    //DROP_OLDEST时丢弃最早的未交给后台线程的缓冲区
+    bool dropOldest();
+private:
+    size_t m_bufferSize;
+    uint32_t m_flushInterval; //ms
+    size_t m_maxBuffers = 16;
+    std::string m_current;               //前台缓冲区
+    size_t m_currentRecords = 0;
+    std::deque<std::string> m_buffers;   //写满待输出的缓冲区
+    std::deque<size_t> m_bufferRecords;  //m_buffers中每块的记录数
+    std::vector<std::string> m_spares;   //已写出可复用的缓冲区
+    size_t m_pendingBytes = 0;           //还没写出的字节数, 包括后台线程正在写出的
+    Thread::pointer m_thread;
+    Semaphore m_semaphore;
+    std::atomic<bool> m_running = {false};
+};
+
+class AsyncFileLogAppender : public AsyncLogAppender {
+public:
+    using pointer = std::shared_ptr<AsyncFileLogAppender>;
+    explicit AsyncFileLogAppender(const std::string& filename
+            , size_t buffer_size = 4 * 1024 * 1024, uint32_t flush_interval = 1000);
+    virtual ~AsyncFileLogAppender() override;
+    virtual std::string toYamlString() override;
+protected:
+    virtual void writeBuffer(const char* data, size_t len) override;
+    virtual void crashWrite(const char* data, size_t len) override;
+private:
+    std::string m_filename;
+    int m_fd = -1;
+};
+
+//gzip压缩输出: 压缩在AsyncLogAppender的后台线程中按整块缓冲区进行, 调用线程不受影响
+//每次批量写出后做一次Z_FULL_FLUSH作为同步点, 进程崩溃后文件可以解压到最后一个同步点
+//信号处理函数中不能压缩, 崩溃时还没交给后台线程的内容会丢失
+//每次打开都追加一个新的gzip member, zcat可以直接读取整个文件
+class GzipLogAppender : public AsyncLogAppender {
+public:
+    using pointer = std::shared_ptr<GzipLogAppender>;
+    explicit GzipLogAppender(const std::string& filename, int compress_level = 6
+            , size_t buffer_size = 4 * 1024 * 1024, uint32_t flush_interval = 1000);
+    virtual ~GzipLogAppender() override;
+    virtual std::string toYamlString() override;
+
+    int getCompressLevel() const {
+        return m_compressLevel;
+    }
+
+    //压缩前/后的字节数
+    uint64_t getRawBytes() const {
+        return m_rawBytes;
+    }
+
+    uint64_t getCompressedBytes() const {
+        return m_compressedBytes;
+    }
+protected:
+    virtual void writeBuffer(const char* data, size_t len) override;
+    virtual void flushOutput() override;
+private:
+    void deflateOutput(int flush);
+private:
+    std::string m_filename;
+    int m_compressLevel;
+    int m_fd = -1;
+    std::unique_ptr<z_stream_s> m_stream;
+    std::string m_out;
+    std::atomic<uint64_t> m_rawBytes = {0};
+    std::atomic<uint64_t> m_compressedBytes = {0};
+};
+
+//滚动文件: 当前文件写满max_size字节, 或跨过rotate_interval秒(按UTC对齐)时切换到新文件
+//旧文件重命名为 filename.YYYYmmdd-HHMMSS[.n], 最多保留max_files个(0表示不删除)
+//后台线程预先创建下一个文件并用fallocate预留空间, 同时负责关闭旧文件和删除多余的归档,
+//写入线程切换文件时只需要两次rename; 后台线程先用临时名创建, 持有m_mutex时才改名为filename.next,
+//所以filename.next只在持锁时被创建或改名
+class RollingFileLogAppender : public LogAppender {
+public:
+    using pointer = std::shared_ptr<RollingFileLogAppender>;
+    explicit RollingFileLogAppender(const std::string& filename, uint64_t max_size = 64 * 1024 * 1024
+            , uint32_t rotate_interval = 0, uint32_t max_files = 0);
+    virtual ~RollingFileLogAppender() override;
+    virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override;
+    virtual void logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+            , const std::string& formatted) override;
+    virtual bool usesFormatter() const override {
+        return true;
+    }
+    virtual std::string toYamlString() override;
+
+    //重新打开当前文件(追加), 用于文件被外部移动之后
+    bool reopen();
+
+    uint64_t getMaxSize() const {
+        return m_maxSize;
+    }
+
+    uint32_t getRotateInterval() const {
+        return m_rotateInterval;
+    }
+
+    uint32_t getMaxFiles() const {
+        return m_maxFiles;
+    }
+private:
+    //以下函数调用时需持有m_mutex
+    void rotate(time_t now);
+    std::string archiveName(time_t now);
+
+    void run();
+    int openSegment(const std::string& path);
+private:
+    std::string m_filename;
+    std::string m_nextFilename;
+    std::string m_pendingFilename; //后台线程创建下一个文件时使用的临时名
+    uint64_t m_maxSize;
+    uint32_t m_rotateInterval; //s
+    uint32_t m_maxFiles;
+    int m_fd = -1;
+    uint64_t m_size = 0;
+    uint64_t m_period = 0;    //当前文件所属的时间段
+    int m_nextFd = -1;        //后台线程准备好的下一个文件
+    std::vector<int> m_retired;           //待后台线程关闭的旧文件
+    std::deque<std::string> m_archives;   //已有的归档, 由旧到新
+    std::string m_lastArchive;
+    uint32_t m_archiveSeq = 0;
+    Thread::pointer m_thread;
+    Semaphore m_semaphore;
+    std::atomic<bool> m_running = {false};
+};
+
+//内存映射文件: 文件按chunk_size分块映射, 写入线程用一次fetch_add预留位置后直接memcpy,
+//不加锁也没有系统调用, 由内核回写脏页; 进程崩溃后已写入的内容仍在页缓存中
+//块写满(所有预留的字节都已拷贝完)时由最后一个写入者解除映射, 关闭时把文件截断为实际长度
+class MmapLogAppender : public LogAppender {
+public:
+    using pointer = std::shared_ptr<MmapLogAppender>;
+    static const size_t kMaxChunks = 4096;
+
+    explicit MmapLogAppender(const std::string& filename, size_t chunk_size = 16 * 1024 * 1024);
+    virtual ~MmapLogAppender() override;
+    virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override;
+    virtual void logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+            , const std::string& formatted) override;
+    virtual bool usesFormatter() const override {
+        return true;
+    }
+    virtual std::string toYamlString() override;
+
+    //已写入的字节数(包括打开前文件中已有的内容)
+    uint64_t getSize() const {
+        return m_cursor;
+    }
+
+    size_t getChunkSize() const {
+        return m_chunkSize;
+    }
+private:
+    struct Chunk {
+        std::atomic<char*> data = {nullptr};
+        std::atomic<uint64_t> committed = {0};
+    };
+
+    char* mapChunk(size_t index);
+    void commit(size_t index, size_t len);
+private:
+    std::string m_filename;
+    int m_fd = -1;
+    size_t m_chunkSize;
+    uint64_t m_fileSize = 0;
+    std::atomic<uint64_t> m_cursor = {0};
+    std::unique_ptr<Chunk[]> m_chunks;
+    Mutex m_mapMutex;
+};
+
+//内存环形缓冲: 每个线程一块预先分配的capacity字节的环形缓冲区, 写满后覆盖最早的记录,
+//每条日志只有一次memcpy, 不写文件; 需要时把所有线程缓冲区中的记录追加到path:
+//  调用dump(), 出现级别>=dump_level的日志(UNKONWN表示不自动输出), 或进程崩溃(见LogCrashHandler)
+//输出后清空缓冲区
+//raw为true时不使用formatter, 只保存 [logger] file:line 消息, 输出时加上UTC时间和级别
+class MemoryRingLogAppender : public LogAppender {
+public:
+    using pointer = std::shared_ptr<MemoryRingLogAppender>;
+    //超出的线程不记录
+    static const size_t kMaxThreads = 1024;
+
+    explicit MemoryRingLogAppender(const std::string& path, size_t capacity = 256 * 1024
+            , LogLevel::Level dump_level = LogLevel::ERROR, bool raw = false);
+    virtual ~MemoryRingLogAppender() override;
+    virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override;
+    virtual void logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+            , const std::string& formatted) override;
+    virtual bool usesFormatter() const override {
+        return !m_raw;
+    }
+    virtual std::string toYamlString() override;
+    virtual void crashFlush() override;
+
+    //reason写在输出的第一行
+    void dump(const char* reason = "request");
+
+    //每个线程的环形缓冲区字节数; 不是LogAppender::getCapacity()意义上的输出缓冲区
+    size_t getRingCapacity() const {
+        return m_capacity;
+    }
+
+    LogLevel::Level getDumpLevel() const {
+        return m_dumpLevel;
+    }
+
+    bool isRaw() const {
+        return m_raw;
+    }
+
+    struct Ring;
+private:
+    Ring* getRing();
+    void append(LogLevel::Level level, const LogEvent& event, const char* data, size_t len);
+    //crash为true时在信号处理函数中执行, 只尝试加锁
+    void dumpRings(const char* reason, bool crash);
+private:
+    const uint64_t m_id;  //区分线程局部缓存中的appender
+    std::string m_path;
+    size_t m_capacity;
+    LogLevel::Level m_dumpLevel;
+    bool m_raw;
+    //按线程id只追加, 析构时释放; 崩溃时不加锁遍历
+    std::unique_ptr<std::atomic<Ring*>[]> m_rings;
+    std::atomic<size_t> m_ringCount = {0};
+    Mutex m_dumpMutex;
+};
+
+//Unix域socket输出, 用于把日志交给本机的收集进程, 不需要先写一次磁盘
+//调用线程只把格式化后的记录放进有界队列, 后台线程用非阻塞socket批量发送, 调用线程不会因为对端而阻塞
+//  datagram: 每条记录一个报文(sendmmsg批量发送); stream: 多条记录用writev一起发送
+//  syslog为true时按RFC5424加上"<PRI>1 时间 主机名 app_name 进程id 日志器名 -"头, 去掉结尾的换行,
+//  stream时再按RFC6587的octet counting加上"长度 "前缀; 否则直接发送格式化后的内容
+//对端慢或不可用时记录留在队列里, 队列超过max_bytes时按过载策略处理(默认DROP_NEWEST, 见LogOverload)
+//连接失败或断开后每隔flush_interval毫秒重连, stream重连后未发完的记录从头重发
+class SocketLogAppender : public LogAppender {
+public:
+    using pointer = std::shared_ptr<SocketLogAppender>;
+    //每次最多从队列取出的记录数
+    static const size_t kMaxBatch = 64;
+
+    explicit SocketLogAppender(const std::string& path, bool stream = false, bool syslog = false
+            , size_t max_bytes = 4 * 1024 * 1024, uint32_t flush_interval = 100
+            , const std::string& app_name = "", int facility = 1);
+    virtual ~SocketLogAppender() override;
+    virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override;
+    virtual void logFormatted(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event
+            , const std::string& formatted) override;
+    virtual bool usesFormatter() const override {
+        return true;
+    }
+    virtual std::string toYamlString() override;
+    //崩溃时只尝试非阻塞发送队列中的记录
+    virtual void crashFlush() override;
+
+    const std::string& getPath() const {
+        return m_path;
+    }
+
+    bool isStream() const {
+        return m_stream;
+    }
+
+    bool isSyslog() const {
+        return m_syslog;
+    }
+
+    virtual size_t getCapacity() const override {
+        return m_maxBytes;
+    }
+
+    uint32_t getFlushInterval() const {
+        return m_flushInterval;
+    }
+
+    //已发送的记录数, 丢弃的记录数见getMetrics()
+    uint64_t getSent() const {
+        return m_sent;
+    }
+private:
+    void run();
+    //以下函数只在后台线程中调用
+    bool connectPeer();
+    void closePeer();
+    //发送m_batch中从m_next开始的记录, 返回本次完成(发送或因过长丢弃)的记录数
+    //对端暂时不可写时最多等待flush_interval毫秒
+    size_t sendBatch();
+private:
+    std::string m_path;
+    bool m_stream;
+    bool m_syslog;
+    size_t m_maxBytes;
+    uint32_t m_flushInterval; //ms
+    std::string m_appName;
+    int m_facility;
+    std::string m_syslogFields;  //" 主机名 app_name 进程id "
+    int m_fd = -1;
+    uint64_t m_lastConnect = 0;  //ms, 限制重连频率
+    //后台线程从队列中取出正在发送的记录, 取出和清空时持有m_mutex
+    std::vector<std::string> m_batch;
+    size_t m_next = 0;    //第一条未发送完的记录
+    size_t m_offset = 0;  //stream时这条记录已发送的字节数
+
+    std::deque<std::string> m_queue;  //等待后台线程取走的记录
+    size_t m_queueBytes = 0;          //m_queue和后台线程未发送完的记录的总字节数
+    std::atomic<uint64_t> m_sent = {0};
+    Thread::pointer m_thread;
+    Semaphore m_semaphore;
+    std::atomic<bool> m_running = {false};
+};
+
+//二进制日志: 只写入调用点id和编码后的参数, 不做任何格式化, 由log_decode还原成文本
+//调用点/Logger的静态信息在第一次出现时写入一次
+//文件格式(本机字节序):
+//  头: "WFBLOG1\n"
+//  'S' u32 site_id, i32 line, u8 level, u16 file_len, file, u32 fmt_len, fmt
+//  'L' u32 logger_id, u16 name_len, name
+//  'E' u32 site_id, u32 logger_id, u8 level, u64 time_us, u32 elapse, u32 thread_id, u32 fiber_id,
+//      u16 thread_name_len, thread_name, [site_id == 0时: u16 file_len, file, i32 line], u32 payload_len, payload
+//      site_id != 0时payload为编码后的参数, 否则为消息文本
+class BinaryLogAppender : public LogAppender {
+public:
+    using pointer = std::shared_ptr<BinaryLogAppender>;
+    static const char* const kMagic;
+
+    explicit BinaryLogAppender(const std::string& filename);
+    virtual ~BinaryLogAppender() override;
+    virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::pointer event) override;
+    virtual std::string toYamlString() override;
 private:
     std::string m_filename;
     std::ofstream m_filestream;
+    std::vector<bool> m_sites;  //已写入定义的调用点
+    std::map<std::string, uint32_t> m_loggers;
 };
 
+//日志器按名字查找: 名字表修改时复制一份新的再原子替换并增加版本号,
+//每个线程缓存一份快照, 版本号不变时查找不加锁也不修改引用计数
 class LoggerManager{
 public:
     using MutexType = Spinlock;
+    using LoggerMap = std::map<std::string, Logger::pointer>;
     LoggerManager();
+    //不存在时创建, 缺少的上级日志器("a.b.c"的"a"和"a.b")也一起创建
     Logger::pointer getLogger(const std::string& name);
+    std::vector<Logger::pointer> getLoggers();
 
     void init();
 
@@ -326,23 +1654,239 @@ public:
     }
 
     const std::string toYamlString(){
-        MutexType::Lock lock(m_mutex);
         YAML::Node node;
-        for(auto& logger : m_loggers){
+        for(auto& logger : *std::atomic_load(&m_loggers)){
             node.push_back(YAML::Load(logger.second->toYamlString()));
         }
         std::stringstream ss;
         ss << node;
         return ss.str();
     }
+private:
+    //调用者持有m_mutex, map为正在构建的新名字表
+    Logger::pointer getOrCreateLocked(LoggerMap& map, const std::string& name);
 private:
     MutexType m_mutex;
-    std::map<std::string, Logger::pointer> m_loggers;
+    std::shared_ptr<const LoggerMap> m_loggers;
+    std::atomic<uint64_t> m_version = {0};
     Logger::pointer m_root;
 };
 
 using LoggerMgr = Singleton<LoggerManager>;
 
+//====================== Defination of LogPipeline ======================
+//每个线程把日志事件写入自己的单生产者单消费者环形队列,
+//由一个收集线程按时间戳归并后交给Logger输出, 工作线程之间不再竞争Logger/Appender的锁
+//未对所有线程启用时, 可以只让协程(GetFiberId() != 0)中的日志经过这里(log.fiber.offload, 默认关闭),
+//避免协程在appender的锁或慢速磁盘上等待时整个调度线程上的其它协程都停下来
+//协程中仍会阻塞的情况:
+//  1. ERROR及以上同步输出, 保证进程随后退出时不丢失
+//  2. 收集线程未启动时第一次写入, 以及每个线程第一次写入时创建队列, 会短暂持有m_mutex
+//队列满时事件放入无锁的溢出链表, 链表也满(ring_size条)时丢弃并计数, 不会阻塞
+class LogPipeline {
+public:
+    using MutexType = Mutex;
+
+    LogPipeline();
+    ~LogPipeline();
+
+    //对所有线程启用; ring_size会向上取整为2的幂
+    void start(size_t ring_size = 8192);
+    //停止收集线程, 等正在写入的线程完成后输出所有队列中剩余的事件
+    void stop();
+
+    //返回false表示未启用或当前线程的队列已满, 调用者应直接同步输出
+    bool push(const LogEvent::pointer& event);
+
+    //协程中调用: 收集线程未运行时先启动; 队列满时放入溢出链表或丢弃
+    void pushFromFiber(const LogEvent::pointer& event);
+
+    static bool IsEnabled() {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    static bool IsFiberOffload() {
+        return s_fiberOffload.load(std::memory_order_relaxed);
+    }
+
+    static void SetFiberOffload(bool v) {
+        s_fiberOffload = v;
+    }
+
+    //协程中因队列满放入溢出链表的次数
+    uint64_t getFiberOverflows() const {
+        return m_fiberOverflows;
+    }
+
+    //溢出链表也满时丢弃的次数
+    uint64_t getFiberDrops() const {
+        return m_fiberDrops;
+    }
+
+    struct Ring;
+    struct OverflowNode;
+private:
+    //只启动收集线程, 不改变IsEnabled()
+    void startCollector(size_t ring_size);
+    //当前线程的队列; 协程让出后可能在其它线程恢复, 每次都要重新获取
+    Ring* threadRing();
+    std::shared_ptr<Ring> createRing();
+    void wakeCollector();
+    //取出溢出链表中的所有事件, 按时间戳排序
+    void takeOverflow(std::vector<std::pair<uint64_t, LogEvent::pointer>>& events);
+    void run();
+    //按时间戳归并输出当前所有队列中的事件, 返回输出数量
+    size_t drain(std::vector<std::shared_ptr<Ring>>& rings);
+private:
+    MutexType m_mutex;
+    std::vector<std::shared_ptr<Ring>> m_rings;
+    std::atomic<uint64_t> m_ringsVersion = {0};
+    size_t m_ringSize = 8192;
+    Thread::pointer m_thread;
+    Semaphore m_semaphore;
+    std::atomic<bool> m_running = {false};
+    std::atomic<bool> m_sleeping = {false};
+    std::atomic<OverflowNode*> m_overflow = {nullptr};
+    std::atomic<size_t> m_overflowSize = {0};
+    std::atomic<uint64_t> m_fiberOverflows = {0};
+    std::atomic<uint64_t> m_fiberDrops = {0};
+
+    static std::atomic<bool> s_enabled;
+    static std::atomic<bool> s_fiberOffload;
+};
+
+using LogPipelineMgr = Singleton<LogPipeline>;
+
+//====================== Defination of LogCrashHandler ======================
+//进程收到SIGSEGV/SIGABRT/SIGBUS/SIGFPE/SIGILL时, 在信号处理函数中只用write(2)输出:
+//  1. 有缓冲的appender(批量输出的File/Stdout, 异步File)中还没写出的内容, 写到各自的fd
+//  2. 每个线程最近ring_size条日志(每条截断到kTextSize字节), 写到path(为空时写到stderr)
+//  3. 调用栈
+//然后恢复原来的信号处理方式并重新发出信号
+//开启后每条日志在调用线程中额外复制一份到该线程的环形缓冲区, 使用LOG_FMT_*的日志因此会在调用线程中格式化
+class LogCrashHandler {
+public:
+    static const size_t kMaxAppenders = 64;
+    static const size_t kMaxRings = 1024;
+    static const size_t kTextSize = 240;
+
+    static void Install(uint32_t ring_size = 32, const std::string& path = "");
+    static void Uninstall();
+
+    static bool IsInstalled() {
+        return s_installed.load(std::memory_order_relaxed);
+    }
+
+    //记录到当前线程的环形缓冲区, 由LogEventWrap在输出前调用
+    static void Record(const LogEvent& event);
+
+    //开始缓冲时注册, 停止缓冲或析构前注销
+    static void AddAppender(LogAppender* appender);
+    static void DelAppender(LogAppender* appender);
+
+    //执行信号处理函数中的输出过程, sig为0时不输出信号信息
+    static void Dump(int sig);
+
+    struct Ring;
+private:
+    static std::atomic<bool> s_installed;
+};
+
+
+//====================== 编译期日志格式 ======================
+//与pattern中的格式项一一对应, 供LogFormatter::Create使用
+namespace logfmt {
+
+#define LOGFMT_ITEM(Name, str, expr) \
+    struct Name { \
+        static void format(std::string& buf, size_t& width, LogLevel::Level level, const LogEvent& event) { \
+            expr; \
+        } \
+        static std::string pattern() { \
+            return str; \
+        } \
+    };
+
+LOGFMT_ITEM(Message, "%m", LogFormatter::Append(buf, width, event.getContentData(), event.getContentSize()))
+LOGFMT_ITEM(Level, "%p", const char* name = LogLevel::ToString(level); LogFormatter::Append(buf, width, name, strlen(name)))
+LOGFMT_ITEM(Elapse, "%r", LogFormatter::AppendNumber(buf, width, event.getElapse()))
+LOGFMT_ITEM(Name, "%c", const std::string& name = event.getLogger()->getName(); LogFormatter::Append(buf, width, name.c_str(), name.size()))
+LOGFMT_ITEM(ThreadId, "%t", LogFormatter::AppendNumber(buf, width, event.getThreadId()))
+LOGFMT_ITEM(NewLine, "%n", LogFormatter::AppendNewLine(buf, width))
+LOGFMT_ITEM(Filename, "%f", LogFormatter::Append(buf, width, event.getFile(), strlen(event.getFile())))
+LOGFMT_ITEM(Line, "%l", LogFormatter::AppendNumber(buf, width, event.getLine()))
+LOGFMT_ITEM(Tab, "%T", LogFormatter::AppendTab(buf, width))
+LOGFMT_ITEM(FiberId, "%F", LogFormatter::AppendNumber(buf, width, event.getFiberId()))
+LOGFMT_ITEM(ThreadName, "%N", const std::string& name = event.getThreadName(); LogFormatter::Append(buf, width, name.c_str(), name.size()))
+LOGFMT_ITEM(Json, "%J", static const LogFormatter::DateTimeFormat s_format(LogFormatter::kJsonDateFormat); LogFormatter::AppendJson(buf, width, s_format, level, event))
+
+#undef LOGFMT_ITEM
+
+struct DefaultDateFormat {
+    static const char* value() {
+        return "%Y-%m-%d %H:%M:%S";
+    }
+};
+
+template<class Format = DefaultDateFormat>
+struct DateTime {
+    static void format(std::string& buf, size_t& width, LogLevel::Level level, const LogEvent& event) {
+        static const LogFormatter::DateTimeFormat s_format(Format::value());
+        LogFormatter::AppendDateTime(buf, width, s_format, event.getTime(), event.getUsec());
+    }
+    static std::string pattern() {
+        return std::string("%d{") + Format::value() + "}";
+    }
+};
+
+template<char C>
+struct Char {
+    static void format(std::string& buf, size_t& width, LogLevel::Level level, const LogEvent& event) {
+        const char c = C;
+        LogFormatter::Append(buf, width, &c, 1);
+    }
+    static std::string pattern() {
+        return C == '%' ? "%%" : std::string(1, C);
+    }
+};
+
+template<class... Items>
+struct Pattern;
+
+template<>
+struct Pattern<> {
+    static void format(std::string& buf, size_t& width, LogLevel::Level level, const LogEvent& event) {
+    }
+    static std::string pattern() {
+        return "";
+    }
+};
+
+template<class Head, class... Tail>
+struct Pattern<Head, Tail...> {
+    static void format(std::string& buf, size_t& width, LogLevel::Level level, const LogEvent& event) {
+        Head::format(buf, width, level, event);
+        Pattern<Tail...>::format(buf, width, level, event);
+    }
+    static std::string pattern() {
+        return Head::pattern() + Pattern<Tail...>::pattern();
+    }
+};
+
+template<class... Items>
+void StaticFormat(std::string& buf, LogLevel::Level level, const LogEvent& event) {
+    size_t width = 0;
+    Pattern<Items...>::format(buf, width, level, event);
+}
+
+}
+
+template<class... Items>
+LogFormatter::pointer LogFormatter::Create() {
+    LogFormatter::pointer formatter = std::make_shared<LogFormatter>(logfmt::Pattern<Items...>::pattern());
+    formatter->m_static = &logfmt::StaticFormat<Items...>;
+    return formatter;
+}
 
 //以下两个结构体用于将配置文件中的参数保存管理
 /**
@@ -353,19 +1897,81 @@ using LoggerMgr = Singleton<LoggerManager>;
  *   appender:
  *      - type:
  *        path(filename)
+ *        async: (File only)
+ *        buffer_size:
+ *        flush_interval: (ms)
+ *        max_size: (RollingFile, bytes)
+ *        rotate_interval: (RollingFile, s)
+ *        max_files: (RollingFile)
+ *        batch_bytes: (File/Stdout, 0关闭批量输出)
+ *        batch_records: (File/Stdout)
+ *        batch_delay: (File/Stdout, ms)
+ *        chunk_size: (Mmap, bytes)
  *      - type:
  */
 struct LogAppenderDefine{
-    int type=0; //1 File 2 Stdout
+    int type=0; //1 File 2 Stdout 3 Binary 4 RollingFile 5 Mmap 6 Gzip 7 MemoryRing 8 Socket
     LogLevel::Level level = LogLevel::UNKONWN;
     std::string format = "";
     std::string file;
+    //仅对File有效: 开启后使用AsyncFileLogAppender
+    bool async = false;
+    //对async File和Gzip有效, Socket时buffer_size为队列的最大字节数
+    uint32_t buffer_size = 4 * 1024 * 1024;
+    uint32_t flush_interval = 1000; //ms
+    //仅对RollingFile有效
+    uint64_t max_size = 64 * 1024 * 1024;
+    uint32_t rotate_interval = 0; //s
+    uint32_t max_files = 0;
+    //仅对Mmap有效
+    uint32_t chunk_size = 16 * 1024 * 1024;
+    //仅对Gzip有效
+    int compress_level = 6;
+    //仅对MemoryRing有效
+    uint32_t capacity = 256 * 1024;
+    LogLevel::Level dump_level = LogLevel::ERROR;
+    bool raw = false;
+    //仅对Socket有效, file为socket路径, flush_interval为等待对端和重连的间隔
+    bool stream = false;
+    bool syslog = false;
+    std::string app_name;
+    int facility = 1;
+    //对async File, Gzip和Socket有效: 缓冲区满时的处理方式(见LogOverload), 为空时使用appender的默认值
+    std::string overload;
+    LogLevel::Level overload_level = LogLevel::WARN;
+    //仅对async File和Gzip有效
+    uint32_t max_buffers = 16;
+    //仅对File(非async)/Stdout有效
+    uint32_t batch_bytes = 0;
+    uint32_t batch_records = 0;
+    uint32_t batch_delay = 100; //ms
 
     bool operator==(const LogAppenderDefine& other) const {
         return type == other.type
                && level == other.level
                && format == other.format
-               && file == other.file;
+               && file == other.file
+               && async == other.async
+               && buffer_size == other.buffer_size
+               && flush_interval == other.flush_interval
+               && max_size == other.max_size
+               && rotate_interval == other.rotate_interval
+               && max_files == other.max_files
+               && chunk_size == other.chunk_size
+               && compress_level == other.compress_level
+               && capacity == other.capacity
+               && dump_level == other.dump_level
+               && raw == other.raw
+               && stream == other.stream
+               && syslog == other.syslog
+               && app_name == other.app_name
+               && facility == other.facility
+               && overload == other.overload
+               && overload_level == other.overload_level
+               && max_buffers == other.max_buffers
+               && batch_bytes == other.batch_bytes
+               && batch_records == other.batch_records
+               && batch_delay == other.batch_delay;
     }
 };
 
@@ -5,6 +5,8 @@
 #include "thread.h"
 #include "log.h"
 #include "utils.h"
+#include <errno.h>
+#include <time.h>
 
 Logger::pointer g_logger = LOG_NAME("system");
 //=============================Semaphore=====================================
@@ -37,6 +39,30 @@ void Semaphore::wait() {
 #endif
 }
 
+bool Semaphore::waitFor(uint64_t timeout_ms) {
+#ifdef __APPLE__
+    return dispatch_semaphore_wait(m_semaphore, dispatch_time(DISPATCH_TIME_NOW, timeout_ms * NSEC_PER_MSEC)) == 0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    while (sem_timedwait(&m_semaphore, &ts)) {
+        if (errno == ETIMEDOUT) {
+            return false;
+        }
+        if (errno != EINTR) {
+            throw std::logic_error("sem_timedwait error");
+        }
+    }
+    return true;
+#endif
+}
+
 void Semaphore::notify() {
 #ifdef __APPLE__
     dispatch_semaphore_signal(m_semaphore);
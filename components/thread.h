@@ -24,6 +24,8 @@ public:
     ~Semaphore();
 
     void wait();
+    //超时返回false
+    bool waitFor(uint64_t timeout_ms);
     void notify();
 
 private:
@@ -48,7 +50,9 @@ public:
     }
 
     ~ScopedLockImpl(){
-        m_mutex.unlock();
+        if(m_locked){
+            m_mutex.unlock();
+        }
     }
 
     void lock(){
@@ -80,7 +84,9 @@ public:
     }
 
     ~ReadScopedLockImpl(){
-        m_mutex.unlock();
+        if(m_locked){
+            m_mutex.unlock();
+        }
     }
 
     void lock(){
@@ -111,7 +117,9 @@ public:
     }
 
     ~WriteScopedLockImpl(){
-        m_mutex.unlock();
+        if(m_locked){
+            m_mutex.unlock();
+        }
     }
 
     void lock(){
@@ -149,6 +157,10 @@ public:
         pthread_mutex_lock(&m_mutex);
     }
 
+    bool tryLock(){
+        return pthread_mutex_trylock(&m_mutex) == 0;
+    }
+
     void unlock(){
         pthread_mutex_unlock(&m_mutex);
     }
@@ -243,6 +255,10 @@ public:
         OSSpinLockLock(&m_mutex);
     }
 
+    bool tryLock(){
+        return OSSpinLockTry(&m_mutex);
+    }
+
     void unlock(){
         OSSpinLockUnlock(&m_mutex);
     }
@@ -262,6 +278,10 @@ public:
         pthread_spin_lock(&m_mutex);
     }
 
+    bool tryLock(){
+        return pthread_spin_trylock(&m_mutex) == 0;
+    }
+
     void unlock(){
         pthread_spin_unlock(&m_mutex);
     }
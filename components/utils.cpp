@@ -9,6 +9,8 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <execinfo.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include <vector>
 
@@ -26,6 +28,41 @@ uint32_t GetFiberId(){
     return Fiber::GetFiberId();
 }
 
+uint64_t GetCurrentMS(){
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000ul + tv.tv_usec / 1000;
+}
+
+uint64_t GetCurrentUS(){
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000ul + tv.tv_usec;
+}
+
+//粗粒度单调时钟走vDSO只读一次内核维护的时间, 不需要计算, 精度为一个tick(1~4ms)
+static uint64_t MonotonicCoarseMS(){
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
+static uint64_t ProcessStartMS(){
+    static uint64_t s_start = MonotonicCoarseMS();
+    return s_start;
+}
+
+//加载时就记录启动时间, 而不是第一次打日志的时间
+static uint64_t s_process_start = ProcessStartMS();
+
+uint64_t GetElapseMS(){
+    return MonotonicCoarseMS() - ProcessStartMS();
+}
+
 void Backtrace(std::vector<std::string>& bt, int size, int skip){
     void** array = (void**)malloc(sizeof(void*) * size);
     size_t s = ::backtrace(array, size);
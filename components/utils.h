@@ -19,6 +19,11 @@ pid_t GetThreadId();
 
 uint32_t GetFiberId();
 
+uint64_t GetCurrentMS();
+uint64_t GetCurrentUS();
+//进程启动到现在的毫秒数, 单调时钟, 不受系统时间调整影响
+uint64_t GetElapseMS();
+
 void Backtrace(std::vector<std::string>& bt, int size=64, int skip = 1);
 std::string BacktraceToString(int size = 64, int skip = 2, const std::string& prefix = "");
 